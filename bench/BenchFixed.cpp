@@ -0,0 +1,54 @@
+// Adapter for the 16-bit fixed-point engine of src_claude_openmp (FixedBloom.h). It has
+// no standalone kernels, only the whole 8-bit to RGBA8 bloom.
+#include <BenchImplementation.h>
+#include <FixedBloom.h>
+#include <memory>
+#include <vector>
+#include <omp.h>
+
+namespace {
+
+struct Handle {
+    int width;
+    int height;
+    int channels;
+    std::vector<unsigned char> bytes;
+    std::unique_ptr<FixedBloomContext> context;
+    std::vector<Color> colors;
+    int threads = 0;            // omp_get_max_threads() when `context` was made
+
+    Handle(int width, int height, int channels)
+        : width(width), height(height), channels(channels), bytes((size_t)width * height * channels) {}
+};
+
+void* Create(int width, int height, int channels, const float* samples) {
+    Handle* handle = new Handle(width, height, channels);
+    for (size_t k = 0; k < handle->bytes.size(); ++k) {
+        handle->bytes[k] = (unsigned char)(samples[k] * 255.0f);
+    }
+    return handle;
+}
+
+void Destroy(void* handle) {
+    delete static_cast<Handle*>(handle);
+}
+
+void Reset(void*) {}
+
+// Steady-state frame cost, set up like the float BloomToRGBA8 case
+void BloomRGBA8Op(void* handle, int levels) {
+    Handle& h = *static_cast<Handle*>(handle);
+    if (!h.context || h.context->GetLevels() != levels || h.threads != omp_get_max_threads()) {
+        h.threads = omp_get_max_threads();
+        h.context = std::make_unique<FixedBloomContext>(h.width, h.height, h.channels, levels);
+        h.colors.resize((size_t)h.width * h.height);
+    }
+    h.context->BloomToRGBA8(h.bytes.data(), h.colors.data());
+}
+
+}  // namespace
+
+BenchImplementation GetBenchImplementation_src_claude_openmp_fixed16() {
+    return {"src_claude_openmp_fixed16", 1, true, true, Create, Destroy, Reset,
+            nullptr, nullptr, nullptr, nullptr, nullptr, BloomRGBA8Op, nullptr, nullptr, nullptr};
+}
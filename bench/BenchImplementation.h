@@ -0,0 +1,39 @@
+#pragma once
+
+// One bloom implementation under test (src, src_claude, src_claude_openmp or its 16-bit
+// fixed-point engine src_claude_openmp_fixed16).
+//
+// Every variant keeps its own image type, so the harness only sees an opaque handle made
+// by create(). The handle holds the input image plus whatever scratch the operations need;
+// results are kept in the handle so nothing gets optimized away. Operations a variant
+// doesn't have are nullptr and skipped.
+struct BenchImplementation {
+    const char* name;
+    int sample_bytes;      // sizeof(double), sizeof(float), or 1 for 8-bit input
+    bool threaded;         // Follows omp_set_num_threads()
+    bool any_size;         // Blooms any size with 8 levels, not only sizes that halve exactly
+
+    // `samples` holds width * height * channels normalized values
+    void* (*create)(int width, int height, int channels, const float* samples);
+    void (*destroy)(void* handle);
+
+    // Restores the input image, called untimed before every in-place operation
+    void (*reset)(void* handle);
+
+    void (*downsample)(void* handle);
+    void (*upsample)(void* handle);
+    void (*lerp)(void* handle);
+    // `count` taps at normalized (x, y) pairs, returns their sum
+    double (*bilinear_tap)(void* handle, const float* coords, int count);
+    void (*bloom)(void* handle, int levels);                  // In place
+    void (*bloom_rgba8)(void* handle, int levels);            // Reused context, openmp only
+    void (*load)(void* handle, const char* path);
+    void (*save)(void* handle, const char* path);
+    // Block shape of the resampling loops (0 x 0: row-major), openmp only
+    void (*set_tile)(int width, int height);
+};
+
+BenchImplementation GetBenchImplementation_src();
+BenchImplementation GetBenchImplementation_src_claude();
+BenchImplementation GetBenchImplementation_src_claude_openmp();
+BenchImplementation GetBenchImplementation_src_claude_openmp_fixed16();
@@ -0,0 +1,129 @@
+// Adapter for the single-threaded double versions (src and src_claude).
+//
+// Compiled once per variant with that variant's directory on the include path. Both define
+// MyImage, DownSample, ... at global scope and a main(), so their sources are pulled in
+// inside BENCH_NAMESPACE, with main renamed. Library headers are included up front so
+// their include guards keep them out of the namespace.
+#include <BenchImplementation.h>
+#include <raylib.h>
+#include <assert.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#if !defined(BENCH_NAMESPACE) || !defined(BENCH_NAME) || !defined(BENCH_FACTORY)
+#error "BENCH_NAMESPACE, BENCH_NAME and BENCH_FACTORY must be defined (see CMakeLists.txt)"
+#endif
+
+namespace BENCH_NAMESPACE {
+#define main legacy_main
+#include <MyImage.h>
+#include <MyImage.cpp>
+#include <main.cpp>
+#undef main
+}
+
+namespace {
+
+using BENCH_NAMESPACE::MyImage;
+
+// src exposes a std::vector, src_claude a raw pointer
+template <typename Image>
+double* Data(Image& image) {
+    if constexpr (requires { image.GetRawData(); }) {
+        return image.GetRawData();
+    } else {
+        return image.data.data();
+    }
+}
+
+struct Handle {
+    std::vector<double> input;
+    MyImage image;
+    MyImage other;        // Second Lerp operand
+    MyImage result;
+
+    Handle(int width, int height, int channels)
+        : image(width, height, channels), other(width, height, channels), result(1, 1, channels) {}
+};
+
+void* Create(int width, int height, int channels, const float* samples) {
+    Handle* handle = new Handle(width, height, channels);
+    size_t n = (size_t)width * height * channels;
+    handle->input.assign(samples, samples + n);
+    std::copy(samples, samples + n, Data(handle->image));
+    std::fill(Data(handle->other), Data(handle->other) + n, 0.5);
+    return handle;
+}
+
+void Destroy(void* handle) {
+    delete static_cast<Handle*>(handle);
+}
+
+void Reset(void* handle) {
+    Handle& h = *static_cast<Handle*>(handle);
+    if ((size_t)h.image.width * h.image.height * h.image.channels != h.input.size()) {
+        // Load replaced the image with a different layout
+        h.image = MyImage(h.other.width, h.other.height, h.other.channels);
+    }
+    std::copy(h.input.begin(), h.input.end(), Data(h.image));
+}
+
+void DownSampleOp(void* handle) {
+    Handle& h = *static_cast<Handle*>(handle);
+    h.result = BENCH_NAMESPACE::DownSample(h.image);
+}
+
+void UpsampleOp(void* handle) {
+    Handle& h = *static_cast<Handle*>(handle);
+    h.result = BENCH_NAMESPACE::Upsample(h.image);
+}
+
+void LerpOp(void* handle) {
+    Handle& h = *static_cast<Handle*>(handle);
+    h.result = BENCH_NAMESPACE::Lerp(h.image, h.other, 0.2);
+}
+
+// src samples a MyImage, src_claude a raw buffer
+template <typename Image>
+double Tap(const Image& image, double x, double y, int ch) {
+    if constexpr (requires { BENCH_NAMESPACE::BilinearTap(image, x, y, ch); }) {
+        return BENCH_NAMESPACE::BilinearTap(image, x, y, ch);
+    } else {
+        return BENCH_NAMESPACE::BilinearTap(image.GetRawData(), image.width, image.height, image.channels,
+                                            x, y, ch);
+    }
+}
+
+double BilinearTapOp(void* handle, const float* coords, int count) {
+    Handle& h = *static_cast<Handle*>(handle);
+    double sum = 0.0;
+    for (int k = 0; k < count; ++k) {
+        sum += Tap(h.image, coords[2 * k], coords[2 * k + 1], k % h.image.channels);
+    }
+    return sum;
+}
+
+void BloomOp(void* handle, int levels) {
+    BENCH_NAMESPACE::Bloom(static_cast<Handle*>(handle)->image, levels);
+}
+
+void LoadOp(void* handle, const char* path) {
+    static_cast<Handle*>(handle)->image = MyImage(path);
+}
+
+void SaveOp(void* handle, const char* path) {
+    static_cast<Handle*>(handle)->image.Save(path);
+}
+
+}  // namespace
+
+BenchImplementation BENCH_FACTORY() {
+    return {BENCH_NAME, (int)sizeof(double), false, false, Create, Destroy, Reset,
+            DownSampleOp, UpsampleOp, LerpOp, BilinearTapOp, BloomOp, nullptr, LoadOp, SaveOp, nullptr};
+}
@@ -0,0 +1,501 @@
+// bloom_bench: per-kernel benchmarks of src, src_claude and src_claude_openmp side by side.
+//
+// Every case (variant x kernel x size x channels x threads) gets one untimed warm-up run,
+// then repetitions until ~1 second has been spent (at least 5, at most 50, or --reps N).
+// Results go to stdout (or --out) as JSON, progress goes to stderr:
+//   median_s / p95_s   wall time per call
+//   mpixels_per_s      input pixels per second
+//   gb_per_s           minimum memory traffic per second: every input sample read once and
+//                      every output sample written once, at the variant's sample size
+//   l1d_misses, llc_misses
+//                      L1 data read and last level cache misses per call, summed over the
+//                      threads (only with working perf counters, see CacheCounters.h)
+//
+// The resampling kernels of src_claude_openmp run once per --tiles block shape, so the
+// cache misses of the tiled traversals can be compared with row-major ("row-major" or 0x0).
+//
+// Before the kernels, "numa" reports the copy bandwidth between every pair of NUMA nodes
+// (see Numa.h): threads pinned to the CPUs of cpu_node copy a buffer first touched from
+// memory_node, read and write bytes counted. Local pairs show what one socket can stream,
+// remote ones what a badly placed pyramid level costs. --no-numa skips it.
+//
+// src_claude_openmp_fixed16 is the 16-bit fixed-point engine of src_claude_openmp, which only
+// has BloomToRGBA8 (from 8-bit samples); its other kernels are reported as skipped.
+//
+// Usage: bloom_bench [--quick] [--variants src,src_claude,src_claude_openmp,src_claude_openmp_fixed16]
+//                    [--kernels DownSample,Upsample,Lerp,BilinearTap,Load,Save,Bloom,BloomToRGBA8]
+//                    [--sizes 256x256,1001x777,...] [--channels 1,3,4] [--threads 1,2,4,...]
+//                    [--tiles row-major,256x16,...] [--reps N] [--no-numa] [--out results.json]
+#include <BenchImplementation.h>
+#include <CacheCounters.h>
+#include <ImageAllocator.h>
+#include <Numa.h>
+#include <SimdKernels.h>
+#include <raylib.h>
+#include <algorithm>
+#include <barrier>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <omp.h>
+
+namespace {
+
+struct Size {
+    int width;
+    int height;
+};
+
+struct Options {
+    std::vector<std::string> variants = {"src", "src_claude", "src_claude_openmp", "src_claude_openmp_fixed16"};
+    std::vector<std::string> kernels = {"DownSample", "Upsample", "Lerp", "BilinearTap",
+                                        "Load", "Save", "Bloom", "BloomToRGBA8"};
+    // Powers of two up to 8K UHD, plus odd sizes that don't halve evenly
+    std::vector<Size> sizes = {{256, 256}, {512, 512}, {1024, 1024}, {1001, 777},
+                               {1920, 1080}, {3840, 2160}, {4095, 2047}, {7680, 4320}};
+    std::vector<int> channels = {1, 3, 4};
+    std::vector<int> threads;          // Default: 1, 2, 4, ... and the maximum
+    std::vector<Size> tiles = {{0, 0}, {256, 16}};
+    int reps = 0;                      // 0: adaptive
+    bool numa = true;
+    const char* out = nullptr;
+};
+
+std::vector<std::string> SplitList(const char* list) {
+    std::vector<std::string> items;
+    std::string item;
+    for (const char* p = list; ; ++p) {
+        if (*p == ',' || *p == '\0') {
+            if (!item.empty()) items.push_back(item);
+            item.clear();
+            if (*p == '\0') break;
+        } else {
+            item += *p;
+        }
+    }
+    return items;
+}
+
+std::vector<int> SplitInts(const char* list) {
+    std::vector<int> values;
+    for (const std::string& item : SplitList(list)) {
+        values.push_back(std::atoi(item.c_str()));
+    }
+    return values;
+}
+
+bool ParseOptions(int argc, const char** argv, Options& options) {
+    for (int i = 1; i < argc; ++i) {
+        const char* arg = argv[i];
+        const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
+        if (std::strcmp(arg, "--quick") == 0) {
+            options.sizes = {{256, 256}, {1001, 777}, {1024, 1024}};
+            options.channels = {3};
+            options.threads = {omp_get_max_threads()};
+            continue;
+        }
+        if (std::strcmp(arg, "--no-numa") == 0) {
+            options.numa = false;
+            continue;
+        }
+        if (!value) {
+            return false;
+        }
+        if (std::strcmp(arg, "--variants") == 0) {
+            options.variants = SplitList(value);
+        } else if (std::strcmp(arg, "--kernels") == 0) {
+            options.kernels = SplitList(value);
+        } else if (std::strcmp(arg, "--sizes") == 0) {
+            options.sizes.clear();
+            for (const std::string& item : SplitList(value)) {
+                Size size{};
+                if (std::sscanf(item.c_str(), "%dx%d", &size.width, &size.height) != 2) {
+                    return false;
+                }
+                options.sizes.push_back(size);
+            }
+        } else if (std::strcmp(arg, "--channels") == 0) {
+            options.channels = SplitInts(value);
+        } else if (std::strcmp(arg, "--threads") == 0) {
+            options.threads = SplitInts(value);
+        } else if (std::strcmp(arg, "--tiles") == 0) {
+            options.tiles.clear();
+            for (const std::string& item : SplitList(value)) {
+                Size tile{};
+                if (item != "row-major" && std::sscanf(item.c_str(), "%dx%d", &tile.width, &tile.height) != 2) {
+                    return false;
+                }
+                options.tiles.push_back(tile);
+            }
+        } else if (std::strcmp(arg, "--reps") == 0) {
+            options.reps = std::atoi(value);
+        } else if (std::strcmp(arg, "--out") == 0) {
+            options.out = value;
+        } else {
+            return false;
+        }
+        ++i;
+    }
+
+    if (options.threads.empty()) {
+        int max_threads = omp_get_max_threads();
+        for (int t = 1; t < max_threads; t *= 2) {
+            options.threads.push_back(t);
+        }
+        options.threads.push_back(max_threads);
+    }
+    return true;
+}
+
+// Smooth gradients, a few bright spots to bloom and some noise, all in [0, 1]
+std::vector<float> MakeSyntheticImage(int width, int height, int channels) {
+    std::vector<float> samples((size_t)width * height * channels);
+    unsigned int state = 12345u;
+
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x) {
+            float u = (float)x / width;
+            float v = (float)y / height;
+            float spot = 0.0f;
+            for (int s = 0; s < 4; ++s) {
+                float dx = u - (0.2f + 0.2f * s);
+                float dy = v - (0.3f + 0.15f * s);
+                spot += std::exp(-(dx * dx + dy * dy) * 400.0f);
+            }
+
+            float* pixel = &samples[((size_t)y * width + x) * channels];
+            for (int ch = 0; ch < channels; ++ch) {
+                state = state * 1664525u + 1013904223u;
+                float noise = (state >> 8) * (1.0f / 16777216.0f);
+                float base = ch == 3 ? 1.0f : 0.15f * (u + v + ch * 0.3f) / 2.6f + 0.05f * noise;
+                pixel[ch] = std::min(1.0f, base + spot);
+            }
+        }
+    }
+    return samples;
+}
+
+// Writes `samples` as an 8-bit PNG for the Load benchmark (3 or 4 channels only)
+bool WriteSyntheticPng(const std::vector<float>& samples, int width, int height, int channels,
+                       const char* path) {
+    std::vector<unsigned char> bytes(samples.size());
+    for (size_t k = 0; k < samples.size(); ++k) {
+        bytes[k] = (unsigned char)(samples[k] * 255.0f);
+    }
+    Image image = {
+        .data = bytes.data(),
+        .width = width,
+        .height = height,
+        .mipmaps = 1,
+        .format = channels == 4 ? PIXELFORMAT_UNCOMPRESSED_R8G8B8A8 : PIXELFORMAT_UNCOMPRESSED_R8G8B8,
+    };
+    return ExportImage(image, path);
+}
+
+// Pyramid depth for Bloom. The legacy src/ and src_claude/ code needs every level to halve
+// exactly (its Upsample doubles the size back), so sizes that aren't divisible by 2^8 get
+// fewer levels there. src_claude_openmp blooms any size with 8 levels.
+int BloomLevels(const BenchImplementation& impl, Size size) {
+    if (impl.any_size) {
+        return 8;
+    }
+    int levels = 0;
+    while (levels < 8 && size.width % (2 << levels) == 0 && size.height % (2 << levels) == 0) {
+        ++levels;
+    }
+    return levels;
+}
+
+struct Stats {
+    int reps = 0;
+    double median = 0.0;
+    double p95 = 0.0;
+    CacheMisses misses;    // Per call, zero without counters
+};
+
+// Cache misses are counted around the timed calls only, not around setup()
+template <typename Setup, typename Run>
+Stats Measure(int fixed_reps, CacheCounters& counters, Setup setup, Run run) {
+    using Clock = std::chrono::steady_clock;
+    CacheMisses misses;
+    auto time_once = [&] {
+        setup();
+        counters.Start();
+        auto start = Clock::now();
+        run();
+        std::chrono::duration<double> elapsed = Clock::now() - start;
+        counters.Stop();
+        CacheMisses m = counters.Read();
+        misses.l1d += m.l1d;
+        misses.llc += m.llc;
+        return elapsed.count();
+    };
+
+    double warm_up = time_once();
+    int reps = fixed_reps > 0 ? fixed_reps
+                              : std::clamp((int)(1.0 / std::max(warm_up, 1e-9)), 5, 50);
+
+    misses = CacheMisses();
+    std::vector<double> times;
+    for (int r = 0; r < reps; ++r) {
+        times.push_back(time_once());
+    }
+    std::sort(times.begin(), times.end());
+
+    Stats stats;
+    stats.reps = reps;
+    stats.median = times[times.size() / 2];
+    stats.p95 = times[std::min(times.size() - 1, (size_t)std::ceil(0.95 * times.size()) - 1)];
+    stats.misses = {misses.l1d / reps, misses.llc / reps};
+    return stats;
+}
+
+// Bytes a kernel has to move at least, see the top of the file
+double KernelBytes(const std::string& kernel, Size size, int channels, int sample_bytes) {
+    double pixels = (double)size.width * size.height;
+    double image = pixels * channels * sample_bytes;
+    if (kernel == "DownSample") return image * 1.25;
+    if (kernel == "Upsample") return image * 5.0;
+    if (kernel == "Lerp") return image * 3.0;
+    if (kernel == "BilinearTap") return pixels * 4.0 * sample_bytes;
+    if (kernel == "BloomToRGBA8") return image + pixels * 4.0;
+    return image * 2.0;   // Bloom (in place), Load and Save (8-bit side not counted)
+}
+
+// Copy bandwidth in GB/s of threads pinned to cpu_node on memory first touched from
+// memory_node, best of a few runs
+double NodeCopyBandwidth(int cpu_node, int memory_node) {
+    constexpr size_t kSamples = size_t(16) << 20;   // 64 MB per buffer, well past any LLC
+    constexpr int kReps = 5;
+    std::unique_ptr<float[]> src(new float[kSamples]);
+    std::unique_ptr<float[]> dst(new float[kSamples]);
+
+    // fn(begin, end, thread) on a thread per CPU of `node`, each one pinned to the node
+    auto on_node = [](int node, const auto& fn) {
+        const std::vector<int>& cpus = NumaTopology::Get().GetCpus(node);
+        const int threads = std::max(1, (int)cpus.size());
+        std::vector<std::thread> team;
+        for (int t = 0; t < threads; ++t) {
+            team.emplace_back([&, t] {
+                PinCurrentThread(cpus);
+                fn(kSamples * t / threads, kSamples * (t + 1) / threads, t);
+            });
+        }
+        for (std::thread& thread : team) {
+            thread.join();
+        }
+    };
+
+    on_node(memory_node, [&](size_t begin, size_t end, int) {
+        std::fill(src.get() + begin, src.get() + end, 1.0f);
+        std::fill(dst.get() + begin, dst.get() + end, 0.0f);
+    });
+
+    // Timed between barriers, so starting the threads isn't counted
+    const int threads = std::max(1, (int)NumaTopology::Get().GetCpus(cpu_node).size());
+    std::barrier sync(threads);
+    double best = 0.0;
+    on_node(cpu_node, [&](size_t begin, size_t end, int t) {
+        for (int r = 0; r < kReps; ++r) {
+            sync.arrive_and_wait();
+            auto start = std::chrono::steady_clock::now();
+            std::memcpy(dst.get() + begin, src.get() + begin, (end - begin) * sizeof(float));
+            sync.arrive_and_wait();
+            std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+            if (t == 0 && (r == 0 || elapsed.count() < best)) {
+                best = elapsed.count();
+            }
+        }
+    });
+    return 2.0 * kSamples * sizeof(float) / best / 1e9;
+}
+
+}  // namespace
+
+int main(int argc, const char** argv) {
+    Options options;
+    if (!ParseOptions(argc, argv, options)) {
+        std::fprintf(stderr, "usage: see the top of bench/BenchMain.cpp\n");
+        return 1;
+    }
+
+    SetTraceLogLevel(LOG_WARNING);
+
+    std::vector<BenchImplementation> implementations;
+    for (const std::string& name : options.variants) {
+        if (name == "src") implementations.push_back(GetBenchImplementation_src());
+        else if (name == "src_claude") implementations.push_back(GetBenchImplementation_src_claude());
+        else if (name == "src_claude_openmp") implementations.push_back(GetBenchImplementation_src_claude_openmp());
+        else if (name == "src_claude_openmp_fixed16") implementations.push_back(GetBenchImplementation_src_claude_openmp_fixed16());
+        else std::fprintf(stderr, "unknown variant %s\n", name.c_str());
+    }
+
+    FILE* out = options.out ? std::fopen(options.out, "w") : stdout;
+    if (!out) {
+        std::fprintf(stderr, "can't open %s\n", options.out);
+        return 1;
+    }
+
+    std::string temp_dir = std::filesystem::temp_directory_path().string();
+    std::string png_path = temp_dir + "/bloom_bench_input.png";
+    std::string save_path = temp_dir + "/bloom_bench_output.png";
+
+    bool have_counters = CacheCounters(1).Available();
+    if (!have_counters) {
+        std::fprintf(stderr, "no hardware cache counters, cache misses not reported\n");
+    }
+
+    const char* pin = std::getenv("BLOOM_PIN");
+    std::fprintf(out, "{\n  \"simd\": \"%s\",\n  \"max_threads\": %d,\n  \"cache_counters\": %s,\n"
+                 "  \"pin\": \"%s\",\n  \"allocator\": \"%s\",\n",
+                 GetSimdKernels().name, omp_get_max_threads(), have_counters ? "true" : "false",
+                 pin ? pin : "none", GetDefaultImageAllocator().GetName());
+
+    if (options.numa) {
+        const NumaTopology& topology = NumaTopology::Get();
+        std::fprintf(out, "  \"numa\": [");
+        for (int cpu_node = 0; cpu_node < topology.GetNodeCount(); ++cpu_node) {
+            for (int memory_node = 0; memory_node < topology.GetNodeCount(); ++memory_node) {
+                std::fprintf(stderr, "NUMA copy, CPUs of node %d, memory of node %d\n", cpu_node, memory_node);
+                std::fprintf(out, "%s\n    {\"cpu_node\": %d, \"memory_node\": %d, \"cpus\": %d, \"gb_per_s\": %.6g}",
+                             cpu_node + memory_node == 0 ? "" : ",", cpu_node, memory_node,
+                             (int)topology.GetCpus(cpu_node).size(), NodeCopyBandwidth(cpu_node, memory_node));
+            }
+        }
+        std::fprintf(out, "\n  ],\n");
+    }
+
+    std::fprintf(out, "  \"results\": [");
+    bool first_result = true;
+
+    for (Size size : options.sizes) {
+        for (int channels : options.channels) {
+            std::vector<float> samples = MakeSyntheticImage(size.width, size.height, channels);
+            bool has_png = channels >= 3 &&
+                           WriteSyntheticPng(samples, size.width, size.height, channels, png_path.c_str());
+
+            // One tap per pixel, spread over the whole image
+            std::vector<float> coords((size_t)size.width * size.height * 2);
+            for (size_t k = 0; k < coords.size() / 2; ++k) {
+                coords[2 * k] = (float)((k * 7919) % size.width + 0.37f) / size.width;
+                coords[2 * k + 1] = (float)((k * 104729) % size.height + 0.61f) / size.height;
+            }
+            int taps = (int)(coords.size() / 2);
+
+            for (const BenchImplementation& impl : implementations) {
+                void* handle = impl.create(size.width, size.height, channels, samples.data());
+                const int levels = BloomLevels(impl, size);
+
+                for (const std::string& kernel : options.kernels) {
+                    const char* skipped = nullptr;
+                    if (kernel != "DownSample" && kernel != "Upsample" && kernel != "Lerp" &&
+                        kernel != "BilinearTap" && kernel != "Load" && kernel != "Save" &&
+                        kernel != "Bloom" && kernel != "BloomToRGBA8") {
+                        skipped = "unknown kernel";
+                    } else if ((kernel == "Load" || kernel == "Save") && channels < 3) {
+                        skipped = "needs 3 or 4 channels";
+                    } else if (kernel == "Load" && !has_png) {
+                        skipped = "can't write the input PNG";
+                    } else if ((kernel == "Bloom" || kernel == "BloomToRGBA8") && levels == 0) {
+                        skipped = "size doesn't halve";
+                    } else if ((kernel == "DownSample" && !impl.downsample) || (kernel == "Upsample" && !impl.upsample) ||
+                               (kernel == "Lerp" && !impl.lerp) || (kernel == "BilinearTap" && !impl.bilinear_tap) ||
+                               (kernel == "Load" && !impl.load) || (kernel == "Save" && !impl.save) ||
+                               (kernel == "Bloom" && !impl.bloom) || (kernel == "BloomToRGBA8" && !impl.bloom_rgba8)) {
+                        skipped = "not implemented";
+                    }
+
+                    // In-place kernels get a pristine input before every call
+                    bool in_place = kernel == "Bloom" || kernel == "Load";
+                    volatile double sink = 0.0;
+                    auto setup = [&] {
+                        if (in_place) impl.reset(handle);
+                    };
+                    auto run = [&] {
+                        if (kernel == "DownSample") impl.downsample(handle);
+                        else if (kernel == "Upsample") impl.upsample(handle);
+                        else if (kernel == "Lerp") impl.lerp(handle);
+                        else if (kernel == "BilinearTap") sink = sink + impl.bilinear_tap(handle, coords.data(), taps);
+                        else if (kernel == "Load") impl.load(handle, png_path.c_str());
+                        else if (kernel == "Save") impl.save(handle, save_path.c_str());
+                        else if (kernel == "Bloom") impl.bloom(handle, levels);
+                        else impl.bloom_rgba8(handle, levels);
+                    };
+
+                    // Only the resampling loops have a block shape
+                    bool tiled = impl.set_tile && (kernel == "DownSample" || kernel == "Upsample" ||
+                                                   kernel == "Bloom" || kernel == "BloomToRGBA8");
+                    std::vector<Size> tiles = tiled ? options.tiles : std::vector<Size>{{0, 0}};
+
+                    std::vector<int> thread_counts = impl.threaded ? options.threads : std::vector<int>{1};
+                    for (int threads : thread_counts) {
+                        for (Size tile : tiles) {
+                            char tile_name[32] = "row-major";
+                            if (tile.width > 0 || tile.height > 0) {
+                                std::snprintf(tile_name, sizeof(tile_name), "%dx%d", tile.width, tile.height);
+                            }
+
+                            std::fprintf(out, "%s\n    {\"variant\": \"%s\", \"kernel\": \"%s\", \"width\": %d, "
+                                         "\"height\": %d, \"channels\": %d, \"threads\": %d",
+                                         first_result ? "" : ",", impl.name, kernel.c_str(), size.width,
+                                         size.height, channels, threads);
+                            if (tiled) {
+                                std::fprintf(out, ", \"tile\": \"%s\"", tile_name);
+                            }
+                            first_result = false;
+
+                            if (skipped) {
+                                std::fprintf(out, ", \"skipped\": \"%s\"}", skipped);
+                                continue;
+                            }
+
+                            std::fprintf(stderr, "%s %s %dx%dx%d, %d threads%s%s\n", impl.name, kernel.c_str(),
+                                         size.width, size.height, channels, threads, tiled ? ", tile " : "",
+                                         tiled ? tile_name : "");
+                            omp_set_num_threads(threads);
+                            if (impl.set_tile) {
+                                impl.set_tile(tile.width, tile.height);
+                            }
+                            CacheCounters counters(have_counters ? threads : 0);
+                            Stats stats = Measure(options.reps, counters, setup, run);
+
+                            double mpixels = (double)size.width * size.height / 1e6;
+                            double gb = KernelBytes(kernel, size, channels, impl.sample_bytes) / 1e9;
+                            std::fprintf(out, ", \"levels\": %d, \"reps\": %d, \"median_s\": %.6g, \"p95_s\": %.6g, "
+                                         "\"mpixels_per_s\": %.6g, \"gb_per_s\": %.6g",
+                                         levels, stats.reps, stats.median, stats.p95,
+                                         mpixels / stats.median, gb / stats.median);
+                            if (counters.Available()) {
+                                std::fprintf(out, ", \"l1d_misses\": %.6g, \"llc_misses\": %.6g",
+                                             stats.misses.l1d, stats.misses.llc);
+                            }
+                            std::fprintf(out, "}");
+                            std::fflush(out);
+                        }
+                    }
+                    if (impl.set_tile) {
+                        impl.set_tile(0, 0);
+                    }
+                    impl.reset(handle);
+                }
+
+                impl.destroy(handle);
+            }
+        }
+    }
+
+    std::fprintf(out, "\n  ]\n}\n");
+    if (out != stdout) {
+        std::fclose(out);
+    }
+    std::remove(png_path.c_str());
+    std::remove(save_path.c_str());
+    return 0;
+}
@@ -0,0 +1,104 @@
+// Adapter for src_claude_openmp (float, OpenMP + runtime-dispatched SIMD)
+#include <BenchImplementation.h>
+#include <Bloom.h>
+#include <MyImage.h>
+#include <memory>
+#include <vector>
+#include <omp.h>
+
+namespace {
+
+struct Handle {
+    std::vector<float> input;
+    MyImage<float> image;
+    MyImage<float> other;      // Second Lerp operand
+    MyImage<float> result;
+    std::unique_ptr<BloomContext<float>> context;
+    std::vector<Color> colors;
+    int threads = 0;            // omp_get_max_threads() when `context` was made
+
+    Handle(int width, int height, int channels)
+        : image(width, height, channels), other(width, height, channels), result(1, 1, channels) {}
+};
+
+void* Create(int width, int height, int channels, const float* samples) {
+    Handle* handle = new Handle(width, height, channels);
+    size_t n = handle->image.GetSize();
+    handle->input.assign(samples, samples + n);
+    std::copy(samples, samples + n, handle->image.GetRawData());
+    std::fill(handle->other.GetRawData(), handle->other.GetRawData() + n, 0.5f);
+    return handle;
+}
+
+void Destroy(void* handle) {
+    delete static_cast<Handle*>(handle);
+}
+
+void Reset(void* handle) {
+    Handle& h = *static_cast<Handle*>(handle);
+    if (h.image.GetSize() != h.input.size()) {
+        // Load replaced the image with a different layout
+        h.image = MyImage<float>(h.other.width, h.other.height, h.other.channels);
+    }
+    std::copy(h.input.begin(), h.input.end(), h.image.GetRawData());
+}
+
+void DownSampleOp(void* handle) {
+    Handle& h = *static_cast<Handle*>(handle);
+    h.result = DownSample(h.image);
+}
+
+void UpsampleOp(void* handle) {
+    Handle& h = *static_cast<Handle*>(handle);
+    h.result = Upsample(h.image);
+}
+
+void LerpOp(void* handle) {
+    Handle& h = *static_cast<Handle*>(handle);
+    h.result = Lerp(h.image, h.other, 0.2f);
+}
+
+double BilinearTapOp(void* handle, const float* coords, int count) {
+    Handle& h = *static_cast<Handle*>(handle);
+    double sum = 0.0;
+    for (int k = 0; k < count; ++k) {
+        sum += BilinearTap(h.image, coords[2 * k], coords[2 * k + 1], k % h.image.channels);
+    }
+    return sum;
+}
+
+void BloomOp(void* handle, int levels) {
+    Bloom(static_cast<Handle*>(handle)->image, levels);
+}
+
+// Steady-state frame cost: the context and the output are set up by the first call
+// (and again when the thread count changes, the context sizes its scratch rows for it)
+void BloomRGBA8Op(void* handle, int levels) {
+    Handle& h = *static_cast<Handle*>(handle);
+    if (!h.context || h.context->GetLevels() != levels || h.threads != omp_get_max_threads()) {
+        h.threads = omp_get_max_threads();
+        h.context = std::make_unique<BloomContext<float>>(h.image.width, h.image.height, h.image.channels, levels);
+        h.colors.resize((size_t)h.image.width * h.image.height);
+    }
+    h.context->BloomToRGBA8(h.image, h.colors.data());
+}
+
+void LoadOp(void* handle, const char* path) {
+    static_cast<Handle*>(handle)->image = MyImage<float>(path);
+}
+
+void SaveOp(void* handle, const char* path) {
+    static_cast<Handle*>(handle)->image.Save(path);
+}
+
+void SetTileOp(int width, int height) {
+    SetResampleTile({width, height});
+}
+
+}  // namespace
+
+BenchImplementation GetBenchImplementation_src_claude_openmp() {
+    return {"src_claude_openmp", (int)sizeof(float), true, true, Create, Destroy, Reset,
+            DownSampleOp, UpsampleOp, LerpOp, BilinearTapOp, BloomOp, BloomRGBA8Op, LoadOp, SaveOp,
+            SetTileOp};
+}
@@ -0,0 +1,106 @@
+#include <CacheCounters.h>
+#include <omp.h>
+
+#if defined(__linux__)
+
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <cstring>
+
+namespace {
+
+// Disabled counter for the calling thread, -1 on failure
+int OpenCounter(unsigned int type, unsigned long long config) {
+    perf_event_attr attr;
+    std::memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+void Control(const std::vector<int>& fds, unsigned long request) {
+    for (int fd : fds) {
+        ioctl(fd, request, 0);
+    }
+}
+
+double Sum(const std::vector<int>& fds) {
+    double sum = 0.0;
+    for (int fd : fds) {
+        long long value = 0;
+        if (read(fd, &value, sizeof(value)) == (ssize_t)sizeof(value)) {
+            sum += (double)value;
+        }
+    }
+    return sum;
+}
+
+}  // namespace
+
+CacheCounters::CacheCounters(int threads) {
+    if (threads <= 0) {
+        return;
+    }
+    const unsigned long long l1d_read_miss = PERF_COUNT_HW_CACHE_L1D |
+                                             (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                                             (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    bool ok = true;
+
+    #pragma omp parallel num_threads(threads)
+    {
+        int l1d = OpenCounter(PERF_TYPE_HW_CACHE, l1d_read_miss);
+        int llc = OpenCounter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+
+        #pragma omp critical
+        {
+            ok = ok && l1d >= 0 && llc >= 0;
+            if (l1d >= 0) l1d_fds_.push_back(l1d);
+            if (llc >= 0) llc_fds_.push_back(llc);
+        }
+    }
+
+    // All or nothing, partial counts would be misleading
+    if (!ok) {
+        for (int fd : l1d_fds_) close(fd);
+        for (int fd : llc_fds_) close(fd);
+        l1d_fds_.clear();
+        llc_fds_.clear();
+    }
+}
+
+CacheCounters::~CacheCounters() {
+    for (int fd : l1d_fds_) close(fd);
+    for (int fd : llc_fds_) close(fd);
+}
+
+void CacheCounters::Start() {
+    Control(l1d_fds_, PERF_EVENT_IOC_RESET);
+    Control(llc_fds_, PERF_EVENT_IOC_RESET);
+    Control(l1d_fds_, PERF_EVENT_IOC_ENABLE);
+    Control(llc_fds_, PERF_EVENT_IOC_ENABLE);
+}
+
+void CacheCounters::Stop() {
+    Control(l1d_fds_, PERF_EVENT_IOC_DISABLE);
+    Control(llc_fds_, PERF_EVENT_IOC_DISABLE);
+}
+
+CacheMisses CacheCounters::Read() const {
+    return {Sum(l1d_fds_), Sum(llc_fds_)};
+}
+
+#else
+
+CacheCounters::CacheCounters(int) {}
+CacheCounters::~CacheCounters() {}
+void CacheCounters::Start() {}
+void CacheCounters::Stop() {}
+CacheMisses CacheCounters::Read() const { return {}; }
+
+#endif
@@ -0,0 +1,37 @@
+#pragma once
+#include <vector>
+
+// Hardware cache-miss counters for bloom_bench, read through Linux perf events.
+//
+// perf only follows threads created after a counter is opened, and the OpenMP pool already
+// exists by then, so every thread of the team opens its own counters. User space only,
+// which perf_event_paranoid <= 2 allows. Elsewhere, or when perf is unavailable (containers,
+// VMs without a PMU), Available() is false and nothing is counted.
+
+struct CacheMisses {
+    double l1d = 0.0;       // L1 data cache read misses
+    double llc = 0.0;       // Last level cache misses
+};
+
+class CacheCounters {
+public:
+    // Counters on every thread of an OpenMP team of `threads`, none for 0
+    explicit CacheCounters(int threads);
+    ~CacheCounters();
+
+    CacheCounters(const CacheCounters&) = delete;
+    CacheCounters& operator=(const CacheCounters&) = delete;
+
+    bool Available() const { return !l1d_fds_.empty(); }
+
+    // Zeroes and starts every counter / stops them again
+    void Start();
+    void Stop();
+
+    // Sum over all threads since the last Start()
+    CacheMisses Read() const;
+
+private:
+    std::vector<int> l1d_fds_;
+    std::vector<int> llc_fds_;
+};
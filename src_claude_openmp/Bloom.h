@@ -0,0 +1,1505 @@
+#pragma once
+#include <MyImage.h>
+#include <SimdKernels.h>
+#include <ThreadPool.h>
+#include <Trace.h>
+#include <Tuning.h>
+#include <assert.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <type_traits>
+#include <vector>
+#include <omp.h>
+
+// Optimized bilinear sampling with direct data access
+template <typename T>
+inline T BilinearTap(const MyImage<T>& image, T x, T y, int channel) {
+    int width = image.width;
+    int height = image.height;
+    int channels = image.channels;
+    
+    // Map normalized coordinates to pixel coordinates
+    T px = x * (width - 1);
+    T py = y * (height - 1);
+    
+    int x0 = (int)px;
+    int y0 = (int)py;
+    int x1 = std::min(x0 + 1, width - 1);
+    int y1 = std::min(y0 + 1, height - 1);
+    
+    T dx = px - x0;
+    T dy = py - y0;
+    
+    // Direct memory access for speed
+    const T* row0 = image.GetRow(y0);
+    const T* row1 = image.GetRow(y1);
+    
+    T top_left = row0[x0 * channels + channel];
+    T top_right = row0[x1 * channels + channel];
+    T bottom_left = row1[x0 * channels + channel];
+    T bottom_right = row1[x1 * channels + channel];
+    
+    // Optimized interpolation
+    T top = top_left + dx * (top_right - top_left);
+    T bottom = bottom_left + dx * (bottom_right - bottom_left);
+    return top + dy * (bottom - top);
+}
+
+// Calls fn(channels, skip_alpha) with both as std::integral_constant for the layouts the
+// kernels are specialized for: 1-4 channels, alpha skipped or not for 2 and 4. Other channel
+// counts get channels = 0, which makes the kernels use the runtime image.channels.
+template <typename Fn>
+void DispatchChannels(int channels, bool skip_alpha, const Fn& fn) {
+    switch (channels) {
+        case 1: fn(std::integral_constant<int, 1>(), std::false_type()); break;
+        case 2: skip_alpha ? fn(std::integral_constant<int, 2>(), std::true_type())
+                           : fn(std::integral_constant<int, 2>(), std::false_type()); break;
+        case 3: fn(std::integral_constant<int, 3>(), std::false_type()); break;
+        case 4: skip_alpha ? fn(std::integral_constant<int, 4>(), std::true_type())
+                           : fn(std::integral_constant<int, 4>(), std::false_type()); break;
+        default: fn(std::integral_constant<int, 0>(), std::false_type()); break;
+    }
+}
+
+// Columns [col_begin, col_end) of one output row of Upsample/UpsampleBlend: row `i` of `image`
+// upsampled to new_w x new_h. With Blend the result is mixed into what `dst_row` already holds,
+// dst = upsampled * (1 - t) + dst * t, which is safe in place since every output pixel only
+// reads its own dst value.
+// Channels is image.channels as a compile-time constant (0: read it at runtime). With
+// SkipAlpha the last channel is neither read nor written.
+template <bool Blend, int Channels = 0, bool SkipAlpha = false, typename T>
+void UpsampleRow(const MyImage<T>& image, T* dst_row, int new_w, int new_h, int i,
+                 int col_begin, int col_end, T t) {
+    assert(Channels == 0 || Channels == image.channels);
+    const int c = Channels > 0 ? Channels : image.channels;
+    const int active = SkipAlpha ? c - 1 : c;
+    
+    // Pre-computed kernel weights and offsets
+    static const T coords[9][2] = {
+        {-1.0,  1.0}, { 0.0,  1.0}, { 1.0,  1.0},
+        {-1.0,  0.0}, { 0.0,  0.0}, { 1.0,  0.0},
+        {-1.0, -1.0}, { 0.0, -1.0}, { 1.0, -1.0}
+    };
+    
+    static const T weights[9] = {
+        0.0625, 0.125,  0.0625,
+        0.125,  0.25,   0.125,
+        0.0625, 0.125,  0.0625
+    };
+    
+    T inv_new_w = T(1) / new_w;
+    T inv_new_h = T(1) / new_h;
+    T inv_t = T(1) - t;
+    
+    // Hand-vectorized float kernel for the bulk of the row, picked at startup.
+    // The scalar loop below finishes whatever it left over.
+    int j_begin = col_begin;
+    if constexpr (std::is_same_v<T, float>) {
+        const SimdKernels& simd = GetSimdKernels();
+        if (Blend && simd.upsample_blend_row) {
+            j_begin = simd.upsample_blend_row(image.GetRawData(), image.width, image.height, image.GetFirstRow(),
+                                              c, active, dst_row, new_w, new_h, i, col_begin, col_end, t);
+        } else if (!Blend && simd.upsample_row) {
+            j_begin = simd.upsample_row(image.GetRawData(), image.width, image.height, image.GetFirstRow(),
+                                        c, active, dst_row, new_w, new_h, i, col_begin, col_end);
+        }
+    }
+    
+    for (int j = j_begin; j < col_end; ++j) {
+        T* dst_pixel = dst_row + j * c;
+        
+        if constexpr (Channels > 0) {
+            // Known channel count: each tap's texels and weights are found once for all
+            // channels instead of once per channel in BilinearTap (same arithmetic)
+            T acc[Channels] = {};
+            for (int k = 0; k < 9; ++k) {
+                T x = std::max(T(0), std::min((j + coords[k][0]) * inv_new_w, T(1)));
+                T y = std::max(T(0), std::min((i + coords[k][1]) * inv_new_h, T(1)));
+                T px = x * (image.width - 1);
+                T py = y * (image.height - 1);
+                int x0 = (int)px;
+                int y0 = (int)py;
+                int x1 = std::min(x0 + 1, image.width - 1);
+                int y1 = std::min(y0 + 1, image.height - 1);
+                T dx = px - x0;
+                T dy = py - y0;
+                const T* row0 = image.GetRow(y0);
+                const T* row1 = image.GetRow(y1);
+                
+                for (int ch = 0; ch < active; ++ch) {
+                    T top_left = row0[x0 * Channels + ch];
+                    T top_right = row0[x1 * Channels + ch];
+                    T bottom_left = row1[x0 * Channels + ch];
+                    T bottom_right = row1[x1 * Channels + ch];
+                    T top = top_left + dx * (top_right - top_left);
+                    T bottom = bottom_left + dx * (bottom_right - bottom_left);
+                    acc[ch] += (top + dy * (bottom - top)) * weights[k];
+                }
+            }
+            
+            for (int ch = 0; ch < active; ++ch) {
+                if constexpr (Blend) {
+                    dst_pixel[ch] = acc[ch] * inv_t + dst_pixel[ch] * t;
+                } else {
+                    dst_pixel[ch] = acc[ch];
+                }
+            }
+            continue;
+        }
+        
+        for (int ch = 0; ch < active; ++ch) {
+            T acc = T(0);
+            
+            // Unrolled loop for better performance
+            for (int k = 0; k < 9; ++k) {
+                T x = (j + coords[k][0]) * inv_new_w;
+                T y = (i + coords[k][1]) * inv_new_h;
+                
+                // Clamp coordinates
+                x = std::max(T(0), std::min(x, T(1)));
+                y = std::max(T(0), std::min(y, T(1)));
+                
+                acc += BilinearTap(image, x, y, ch) * weights[k];
+            }
+            
+            if constexpr (Blend) {
+                dst_pixel[ch] = acc * inv_t + dst_pixel[ch] * t;
+            } else {
+                dst_pixel[ch] = acc;
+            }
+        }
+    }
+}
+
+// Output block shape of the resampling loops, in output pixels. A block reads a compact
+// patch of source rows and columns that stays in L1/L2, where the 3-5 full source rows
+// behind one output row no longer do at 8K widths. A width of 0 means whole rows (the plain
+// row-major traversal), a height of 0 the loop's own default row block. Widths are rounded
+// up to kTileWidthAlign so blocks never split a SIMD vector: the result is the same for
+// every shape.
+struct ResampleTile {
+    int width = 0;
+    int height = 0;
+};
+
+constexpr int kTileWidthAlign = 16;      // Widest SIMD vector, in floats
+
+namespace resample_tile_detail {
+
+struct State {
+    ResampleTile tile;
+    bool fixed = false;      // Set by BLOOM_TILE or SetResampleTile(), wins over the tuning profile
+};
+
+// BLOOM_TILE=<width>x<height> (e.g. 256x16) picks the shape at startup, row-major otherwise
+inline State& Current() {
+    static State state = [] {
+        State s;
+        const char* env = std::getenv("BLOOM_TILE");
+        s.fixed = env && std::sscanf(env, "%dx%d", &s.tile.width, &s.tile.height) == 2;
+        if (!s.fixed) {
+            s.tile = ResampleTile();
+        }
+        s.tile.width = std::max(0, s.tile.width);
+        s.tile.height = std::max(0, s.tile.height);
+        return s;
+    }();
+    return state;
+}
+
+}  // namespace resample_tile_detail
+
+inline ResampleTile GetResampleTile() {
+    return resample_tile_detail::Current().tile;
+}
+
+// Changes the shape for every later resampling call, not meant to race with running ones
+inline void SetResampleTile(ResampleTile tile) {
+    resample_tile_detail::Current() = {{std::max(0, tile.width), std::max(0, tile.height)}, true};
+}
+
+// How one resampling call producing a width x height image runs: the tuning profile's entry
+// for that size (see Tuning.h), except for a tile fixed by BLOOM_TILE or SetResampleTile().
+// Without an entry, GetResampleTile() and every thread once there are more than
+// `parallel_rows` output rows.
+struct ResamplePlan {
+    ResampleTile tile;
+    int threads;             // 1: no parallel region
+};
+
+inline ResamplePlan GetResamplePlan(TunedKernel kernel, int width, int height, int parallel_rows) {
+    ResamplePlan plan{GetResampleTile(), height > parallel_rows ? omp_get_max_threads() : 1};
+    if (const KernelTuning* tuning = GetTuningProfile().Find(kernel, (long long)width * height)) {
+        plan.threads = std::max(1, std::min(tuning->threads, omp_get_max_threads()));
+        if (tuning->HasTile() && !resample_tile_detail::Current().fixed) {
+            plan.tile = {tuning->tile_width, tuning->tile_height};
+        }
+    }
+    return plan;
+}
+
+// Rows [row_begin, row_end) x columns [0, width) cut into `tile` blocks, numbered row-major
+// so the block index can drive an OpenMP loop
+struct TileGrid {
+    int row_begin;
+    int row_end;
+    int width;
+    int tile_width;
+    int tile_height;
+    int tiles_x;
+    int count;
+    
+    TileGrid(const ResampleTile& tile, int default_height, int row_begin, int row_end, int width)
+        : row_begin(row_begin), row_end(row_end), width(width),
+          tile_width(tile.width > 0
+                         ? std::min((tile.width + kTileWidthAlign - 1) / kTileWidthAlign * kTileWidthAlign, width)
+                         : width),
+          tile_height(std::max(1, tile.height > 0 ? tile.height : default_height)) {
+        tiles_x = tile_width > 0 ? (width + tile_width - 1) / tile_width : 0;
+        count = tiles_x * ((row_end - row_begin + tile_height - 1) / tile_height);
+    }
+    
+    // Calls row(i, col_begin, col_end) for every row of block `t`
+    template <typename RowFn>
+    void ForEachRow(int t, const RowFn& row) const {
+        int y0 = row_begin + t / tiles_x * tile_height;
+        int x0 = t % tiles_x * tile_width;
+        int y1 = std::min(row_end, y0 + tile_height);
+        int x1 = std::min(width, x0 + tile_width);
+        for (int i = y0; i < y1; ++i) {
+            row(i, x0, x1);
+        }
+    }
+};
+
+// Upsamples `image` to the size of `dst`, see UpsampleRow
+template <bool Blend, typename T>
+void UpsampleInto(const MyImage<T>& image, MyImage<T>& dst, T t) {
+    int new_h = dst.height;
+    int new_w = dst.width;
+    BLOOM_TRACE_SCOPE(Blend ? "UpsampleBlend" : "Upsample",
+                      TraceArgs{.width = new_w, .height = new_h, .channels = dst.channels,
+                                .bytes = (image.GetSize() + dst.GetSize() * (Blend ? 2 : 1)) * sizeof(T)});
+    
+    // Parallel processing of blocks of rows with OpenMP
+    const ResamplePlan plan = GetResamplePlan(TunedKernel::Upsample, new_w, new_h, 64);
+    const TileGrid grid(plan.tile, 16, 0, new_h, new_w);
+    DispatchChannels(image.channels, false, [&](auto channels, auto) {
+        #pragma omp parallel num_threads(plan.threads) if(plan.threads > 1)
+        {
+            BLOOM_TRACE_SCOPE(Blend ? "UpsampleBlend rows" : "Upsample rows");
+            
+            #pragma omp for schedule(dynamic, 1)
+            for (int b = 0; b < grid.count; ++b) {
+                grid.ForEachRow(b, [&](int i, int col_begin, int col_end) {
+                    UpsampleRow<Blend, decltype(channels)::value>(image, dst.GetRow(i), new_w, new_h, i, col_begin, col_end, t);
+                });
+            }
+        }
+    });
+}
+
+// `image` upsampled to new_w x new_h, e.g. the exact size of the level it was downsampled
+// from, which for odd sizes is not twice its own
+template <typename T>
+MyImage<T> Upsample(const MyImage<T>& image, int new_w, int new_h) {
+    MyImage<T> upsampled(new_w, new_h, image.channels, ImageInit::Uninitialized);
+    UpsampleInto<false>(image, upsampled, T(0));
+    return upsampled;
+}
+
+template <typename T>
+MyImage<T> Upsample(const MyImage<T>& image) {
+    return Upsample(image, image.width * 2, image.height * 2);
+}
+
+// Fused Lerp(Upsample(image, dst.width, dst.height), dst, t), written straight into `dst`.
+// Saves both full-size temporaries and one pass over the larger level compared to the two
+// separate calls.
+template <typename T>
+void UpsampleBlend(const MyImage<T>& image, MyImage<T>& dst, T t) {
+    assert(dst.channels == image.channels);
+    UpsampleInto<true>(image, dst, t);
+}
+
+// Size of a level downsampled from one of `size` pixels along an axis: halved, rounded
+// down, but never below 1, so any image size works with any number of levels. Odd sizes
+// lose their last source pixel to the rounding, not to the kernels: both resampling
+// passes map the whole extent of one level onto the whole extent of the other.
+inline int DownSampledSize(int size) {
+    return std::max(1, size / 2);
+}
+
+// Where the pyramid levels and other buffers of a context go in its one arena. Every
+// region is rounded up to `align` elements (a cache line), so each starts on its own lines.
+struct ArenaLayout {
+    struct Level {
+        int width;
+        int height;
+        size_t offset;          // Elements from the start of the arena
+        size_t size;            // width * height * channels
+    };
+    
+    size_t align;
+    size_t total = 0;           // Elements so far
+    std::vector<Level> levels;  // levels[k] is level k + 1
+    
+    explicit ArenaLayout(size_t align) : align(align) {}
+    
+    inline size_t RoundUp(size_t n) const { return (n + align - 1) / align * align; }
+    
+    // Reserves n elements, returns their offset
+    inline size_t Add(size_t n) {
+        const size_t offset = total;
+        total += RoundUp(n);
+        return offset;
+    }
+    
+    // Levels 1..count of a width x height image, each DownSampledSize of the one above
+    inline void AddLevels(int width, int height, int channels, int count) {
+        for (int k = 0; k < count; ++k) {
+            width = DownSampledSize(width);
+            height = DownSampledSize(height);
+            const size_t size = (size_t)width * height * channels;
+            levels.push_back({width, height, Add(size), size});
+        }
+    }
+};
+
+// DownSample tap positions along one axis. The 13 taps only use 5 distinct offsets
+// (-2..+2 output pixels) per axis, so their texels and bilinear weights are computed
+// once per row/column instead of once per tap, pixel and channel. The border clamping
+// is baked into the table, so the kernel itself never clamps.
+template <typename T>
+struct DownSampleAxis {
+    static constexpr int kOffsets = 5;
+    
+    std::vector<int> lo;   // [pos * kOffsets + offset] lower texel, times `scale`
+    std::vector<int> hi;   // ... and the upper one
+    std::vector<T> frac;   // weight of the upper texel
+    
+    // `scale` turns a texel coordinate into an element offset (channels for columns, 1 for rows)
+    DownSampleAxis(int new_size, int src_size, int scale)
+        : lo(new_size * kOffsets), hi(new_size * kOffsets), frac(new_size * kOffsets) {
+        T inv_new_size = T(1) / new_size;
+        for (int pos = 0; pos < new_size; ++pos) {
+            for (int o = 0; o < kOffsets; ++o) {
+                // Same arithmetic as the clamped coordinates + BilinearTap it replaces
+                T u = (pos + T(0.5) + T(o - 2)) * inv_new_size;
+                u = std::max(T(0), std::min(u, T(1)));
+                T p = u * (src_size - 1);
+                int p0 = (int)p;
+                int p1 = std::min(p0 + 1, src_size - 1);
+                
+                lo[pos * kOffsets + o] = p0 * scale;
+                hi[pos * kOffsets + o] = p1 * scale;
+                frac[pos * kOffsets + o] = p - p0;
+            }
+        }
+    }
+};
+
+// Color channels of a `channels` image: RGB(A) or a single gray channel (with alpha)
+inline int ColorChannels(int channels) {
+    return channels >= 3 ? 3 : 1;
+}
+
+// Columns [col_begin, col_end) of row `i` of DownSample into a preallocated `downsampled`
+// using precomputed tap tables (`cols` for its width, `rows` for its height), so repeated
+// calls allocate nothing. Both images may be bands, as long as they hold the rows involved
+// (see DownSampleSourceRows). Channels and SkipAlpha as in UpsampleRow.
+// With Karis each tap is weighted by 1 / (1 + luma) and the weights renormalized (Karis
+// average), so a single very bright texel can't dominate the result and flicker from
+// frame to frame. Scalar only.
+template <int Channels = 0, bool SkipAlpha = false, bool Karis = false, typename T>
+void DownSampleRow(const MyImage<T>& image, MyImage<T>& downsampled,
+                   const DownSampleAxis<T>& cols, const DownSampleAxis<T>& rows, int i,
+                   int col_begin, int col_end) {
+    assert(Channels == 0 || Channels == image.channels);
+    int new_h = downsampled.height;
+    int new_w = downsampled.width;
+    const int c = Channels > 0 ? Channels : image.channels;
+    const int active = SkipAlpha ? c - 1 : c;
+    
+    // Pre-computed coordinates and weights
+    static const T coords[13][2] = {
+        {-1.0,  1.0}, { 1.0,  1.0},
+        {-1.0, -1.0}, { 1.0, -1.0},
+        {-2.0,  2.0}, { 0.0,  2.0}, { 2.0,  2.0},
+        {-2.0,  0.0}, { 0.0,  0.0}, { 2.0,  0.0},
+        {-2.0, -2.0}, { 0.0, -2.0}, { 2.0, -2.0}
+    };
+    
+    static const T weights[13] = {
+        0.125, 0.125, 0.125, 0.125,
+        0.0555555, 0.0555555, 0.0555555,
+        0.0555555, 0.0555555, 0.0555555,
+        0.0555555, 0.0555555, 0.0555555
+    };
+    
+    // Fixed stencil: which per-axis table entry each of the 13 taps reads
+    int tap_x[13];
+    int tap_y[13];
+    for (int k = 0; k < 13; ++k) {
+        tap_x[k] = (int)coords[k][0] + 2;
+        tap_y[k] = (int)coords[k][1] + 2;
+    }
+    
+    T* dst_row = downsampled.GetRow(i);
+    
+    // Hand-vectorized float kernel for the bulk of the row, picked at startup.
+    // The scalar loop below finishes whatever it left over.
+    int j_begin = col_begin;
+    if constexpr (std::is_same_v<T, float> && !Karis) {
+        if (ResampleRowFn simd_row = GetSimdKernels().downsample_row) {
+            j_begin = simd_row(image.GetRawData(), image.width, image.height, image.GetFirstRow(),
+                               c, active, dst_row, new_w, new_h, i, col_begin, col_end);
+        }
+    }
+    
+    // Source rows of the 5 vertical tap offsets
+    const int* row_lo = &rows.lo[i * DownSampleAxis<T>::kOffsets];
+    const int* row_hi = &rows.hi[i * DownSampleAxis<T>::kOffsets];
+    const T* row_frac = &rows.frac[i * DownSampleAxis<T>::kOffsets];
+    const T* src_lo[DownSampleAxis<T>::kOffsets];
+    const T* src_hi[DownSampleAxis<T>::kOffsets];
+    for (int o = 0; o < DownSampleAxis<T>::kOffsets; ++o) {
+        src_lo[o] = image.GetRow(row_lo[o]);
+        src_hi[o] = image.GetRow(row_hi[o]);
+    }
+    
+    for (int j = j_begin; j < col_end; ++j) {
+        T* dst_pixel = dst_row + j * c;
+        const int* col_lo = &cols.lo[j * DownSampleAxis<T>::kOffsets];
+        const int* col_hi = &cols.hi[j * DownSampleAxis<T>::kOffsets];
+        const T* col_frac = &cols.frac[j * DownSampleAxis<T>::kOffsets];
+        
+        // Bilinear tap k of channel ch
+        auto tap = [&](int k, int ch) {
+            const int tx = tap_x[k];
+            const int ty = tap_y[k];
+            const T* row0 = src_lo[ty] + ch;
+            const T* row1 = src_hi[ty] + ch;
+            T top = row0[col_lo[tx]] + col_frac[tx] * (row0[col_hi[tx]] - row0[col_lo[tx]]);
+            T bottom = row1[col_lo[tx]] + col_frac[tx] * (row1[col_hi[tx]] - row1[col_lo[tx]]);
+            return top + row_frac[ty] * (bottom - top);
+        };
+        
+        if constexpr (Karis) {
+            static const T luma_weights[3] = {0.2126, 0.7152, 0.0722};
+            const int color = ColorChannels(c);
+            // Weight of tap k, value(ch) being its sample of channel ch
+            auto tap_weight = [&](int k, const auto& value) {
+                T luma = color == 1 ? value(0) : T(0);
+                for (int ch = 0; color > 1 && ch < color; ++ch) {
+                    luma += value(ch) * luma_weights[ch];
+                }
+                return weights[k] / (T(1) + std::max(luma, T(0)));
+            };
+            
+            T weight_sum = T(0);
+            if constexpr (Channels > 0) {
+                // Each tap interpolated once for all channels
+                T acc[Channels] = {};
+                for (int k = 0; k < 13; ++k) {
+                    T values[Channels];
+                    for (int ch = 0; ch < active; ++ch) {
+                        values[ch] = tap(k, ch);
+                    }
+                    T w = tap_weight(k, [&](int ch) { return values[ch]; });
+                    weight_sum += w;
+                    for (int ch = 0; ch < active; ++ch) {
+                        acc[ch] += values[ch] * w;
+                    }
+                }
+                for (int ch = 0; ch < active; ++ch) {
+                    dst_pixel[ch] = acc[ch] / weight_sum;
+                }
+            } else {
+                T tap_weights[13];
+                for (int k = 0; k < 13; ++k) {
+                    tap_weights[k] = tap_weight(k, [&](int ch) { return tap(k, ch); });
+                    weight_sum += tap_weights[k];
+                }
+                for (int ch = 0; ch < active; ++ch) {
+                    T acc = T(0);
+                    for (int k = 0; k < 13; ++k) {
+                        acc += tap(k, ch) * tap_weights[k];
+                    }
+                    dst_pixel[ch] = acc / weight_sum;
+                }
+            }
+            continue;
+        }
+        
+        for (int ch = 0; ch < active; ++ch) {
+            T acc = T(0);
+            
+            for (int k = 0; k < 13; ++k) {
+                acc += tap(k, ch) * weights[k];
+            }
+            
+            dst_pixel[ch] = acc;
+        }
+    }
+}
+
+// Soft-knee bright-pass over columns [col_begin, col_end) of a row, in place. The color
+// channels are scaled by how far the brightest of them is above `threshold`, with a
+// quadratic ramp from threshold - knee to threshold + knee instead of a hard cut; alpha is
+// left as it is. Channels as in DownSampleRow.
+template <int Channels = 0, typename T>
+void BrightPassRow(T* row, int channels, int col_begin, int col_end, T threshold, T knee) {
+    const int c = Channels > 0 ? Channels : channels;
+    const int color = ColorChannels(c);
+    const T inv_4knee = T(1) / (T(4) * knee + T(1e-5));
+    
+    for (int j = col_begin; j < col_end; ++j) {
+        T* pixel = row + j * c;
+        T brightness = pixel[0];
+        for (int ch = 1; ch < color; ++ch) {
+            brightness = std::max(brightness, pixel[ch]);
+        }
+        T soft = std::max(T(0), std::min(brightness - threshold + knee, T(2) * knee));
+        T contribution = std::max(soft * soft * inv_4knee, brightness - threshold) /
+                         std::max(brightness, T(1e-5));
+        for (int ch = 0; ch < color; ++ch) {
+            pixel[ch] *= contribution;
+        }
+    }
+}
+
+// Rows [row_begin, row_end) of DownSample, see DownSampleRow
+template <typename T>
+void DownSampleRows(const MyImage<T>& image, MyImage<T>& downsampled,
+                    const DownSampleAxis<T>& cols, const DownSampleAxis<T>& rows,
+                    int row_begin, int row_end) {
+    // Reads ~4 source samples per output sample
+    BLOOM_TRACE_SCOPE("DownSample",
+                      TraceArgs{.width = downsampled.width, .height = row_end - row_begin, .channels = image.channels,
+                                .bytes = (size_t)(row_end - row_begin) * downsampled.width * image.channels * 5 * sizeof(T)});
+    
+    // Parallel processing of blocks with dynamic scheduling for load balancing
+    const ResamplePlan plan = GetResamplePlan(TunedKernel::DownSample, downsampled.width, row_end - row_begin, 32);
+    const TileGrid grid(plan.tile, 8, row_begin, row_end, downsampled.width);
+    DispatchChannels(image.channels, false, [&](auto channels, auto) {
+        #pragma omp parallel num_threads(plan.threads) if(plan.threads > 1)
+        {
+            BLOOM_TRACE_SCOPE("DownSample rows");
+            
+            #pragma omp for schedule(dynamic, 1)
+            for (int b = 0; b < grid.count; ++b) {
+                grid.ForEachRow(b, [&](int i, int col_begin, int col_end) {
+                    DownSampleRow<decltype(channels)::value>(image, downsampled, cols, rows, i, col_begin, col_end);
+                });
+            }
+        }
+    });
+}
+
+// Whole-image DownSampleRows
+template <typename T>
+void DownSampleInto(const MyImage<T>& image, MyImage<T>& downsampled,
+                    const DownSampleAxis<T>& cols, const DownSampleAxis<T>& rows) {
+    DownSampleRows(image, downsampled, cols, rows, 0, downsampled.height);
+}
+
+// Source rows (with a one row margin for the float SIMD coordinate math) read by
+// DownSampleRow for output rows [begin, end)
+template <typename T>
+inline void DownSampleSourceRows(const DownSampleAxis<T>& rows, int src_height, int begin, int end,
+                                 int& src_begin, int& src_end) {
+    constexpr int n = DownSampleAxis<T>::kOffsets;
+    int lo = src_height;
+    int hi = 0;
+    for (int k = begin * n; k < end * n; ++k) {
+        lo = std::min(lo, rows.lo[k]);
+        hi = std::max(hi, rows.hi[k]);
+    }
+    src_begin = std::max(0, lo - 1);
+    src_end = std::min(src_height, hi + 2);
+}
+
+// Source rows read by UpsampleRow for output rows [begin, end) of a new_height image,
+// with the same margin
+inline void UpsampleSourceRows(int src_height, int new_height, int begin, int end,
+                               int& src_begin, int& src_end) {
+    auto row = [&](int i) {
+        double y = std::max(0.0, std::min((double)i / new_height, 1.0));
+        return (int)(y * (src_height - 1));
+    };
+    src_begin = std::max(0, row(begin - 1) - 1);
+    src_end = std::min(src_height, row(end) + 3);
+}
+
+
+template <typename T>
+MyImage<T> DownSample(const MyImage<T>& image) {
+    MyImage<T> downsampled(DownSampledSize(image.width), DownSampledSize(image.height), image.channels,
+                           ImageInit::Uninitialized);
+    const DownSampleAxis<T> cols(downsampled.width, image.width, image.channels);
+    const DownSampleAxis<T> rows(downsampled.height, image.height, 1);
+    DownSampleInto(image, downsampled, cols, rows);
+    return downsampled;
+}
+
+template <typename T>
+MyImage<T> Lerp(const MyImage<T>& a, const MyImage<T>& b, T t) {
+    assert(a.width == b.width && a.height == b.height && a.channels == b.channels);
+    
+    MyImage<T> result(a.width, a.height, a.channels, ImageInit::Uninitialized);
+    
+    const T* a_data = a.GetRawData();
+    const T* b_data = b.GetRawData();
+    T* result_data = result.GetRawData();
+    
+    ptrdiff_t total_elements = a.GetSize();
+    T inv_t = T(1) - t;
+    BLOOM_TRACE_SCOPE("Lerp", TraceArgs{.width = a.width, .height = a.height, .channels = a.channels,
+                                        .bytes = 3 * a.GetSize() * sizeof(T)});
+    
+    // Highly parallel vectorized operation
+    #pragma omp parallel for schedule(static) if(total_elements > 10000)
+    for (ptrdiff_t i = 0; i < total_elements; ++i) {
+        result_data[i] = a_data[i] * inv_t + b_data[i] * t;
+    }
+    
+    return result;
+}
+
+// Bloom parameters
+constexpr double kBloomLerpWeight = 0.2;
+constexpr double kBloomMult = 6.0;
+
+// Output stage of BloomToRGBA8
+struct BloomOutput {
+    double mult = kBloomMult;            // Bloom intensity
+    ToneMap tone_map = ToneMap::None;    // Applied after the scale, before the clamp
+};
+
+// How BloomContext lays out its pyramid
+struct BloomLayout {
+    // One single-channel pyramid per channel instead of interleaved pixels. Costs a split
+    // and a merge pass over the full-resolution image, but every kernel runs on contiguous
+    // samples of a single channel.
+    bool planar = false;
+    // Alpha (the last of 2 or 4 channels) isn't blurred, only scaled and clamped like the
+    // other channels at the end, so RGBA costs about what RGB does. Identical output for
+    // opaque images.
+    bool skip_alpha = false;
+};
+
+// Bright-pass of BloomContext, fused into the first DownSample: applied to each level 1
+// pixel as it is produced from the input, which itself is never modified and still feeds
+// the final blend. Nothing else is read or written for it.
+struct BloomPrefilter {
+    // Soft-knee threshold on the brightest color channel, 0 keeps everything
+    double threshold = 0.0;
+    // Half width of the knee as a fraction of threshold, 0 for a hard cut
+    double knee = 0.5;
+    // Karis average in that DownSample (see DownSampleRow), against fireflies
+    bool karis = false;
+    
+    inline bool IsEnabled() const { return threshold > 0.0 || karis; }
+};
+
+// Temporal mode of BloomContext for video: the coarse levels of consecutive frames barely
+// differ, so they are kept from the previous frame while their source level hasn't moved.
+struct BloomTemporal {
+    // Levels from the first one (below level 1) whose larger side is at most this many
+    // pixels are candidates for reuse, 0 turns the mode off
+    int max_level_size = 0;
+    // A candidate level is downsampled again once the mean absolute difference of its
+    // source level to the one it was last built from exceeds this, per sample. 0 only
+    // reuses levels whose source is unchanged, which keeps the output exact.
+    double threshold = 0.002;
+    // ... and at least every this many frames
+    int max_reuse_frames = 8;
+    // Weight of the previous frame in each rebuilt candidate level after its blend, an
+    // exponential moving average against flicker. 0 keeps the frame as is.
+    double smoothing = 0.0;
+    
+    inline bool IsEnabled() const { return max_level_size > 0; }
+};
+
+// What the temporal mode did in the last frame
+struct BloomTemporalStats {
+    int candidate_levels = 0;   // Levels that may be reused
+    int reused_levels = 0;      // ... and were, down to the coarsest one
+    double change = 0.0;        // Mean absolute difference of the first candidate's source
+};
+
+// Reusable bloom engine for one (width, height, channels, levels) configuration.
+//
+// All pyramid levels, their tap tables and the scratch rows of the output stage are
+// allocated (and first touched) once by the constructor, with the levels packed into a
+// single arena. Repeated Bloom()/BloomToRGBA8() calls do no heap allocations at all.
+// A context prints nothing and touches no global state, so separate contexts can run
+// concurrently on different threads; a single context is not meant to be shared.
+//
+// The pyramid is built as a row wavefront instead of level by level: every level is cut
+// into tasks of a few rows, and a task starts as soon as the rows it reads are final.
+// Rows of level k + 1 are downsampled while level k is still being produced (and still
+// in cache), the small levels run alongside the big ones instead of on a single thread,
+// and the upsample/blend chain down to the output rows is scheduled the same way. A frame
+// is one task graph on the persistent ThreadPool, so there is no fork/join per frame and
+// no thread waits on a task that isn't ready yet.
+//
+// An optional BloomPrefilter thresholds what gets blurred, and SetTemporal() reuses coarse
+// levels across frames (both interleaved layout only).
+template <typename T = float>
+class BloomContext {
+public:
+    BloomContext(int width, int height, int channels, int levels = 8, const BloomLayout& layout = {},
+                 const BloomPrefilter& prefilter = {});
+    
+    // Levels are views into arena_, copying would leave them pointing at the original
+    BloomContext(const BloomContext&) = delete;
+    BloomContext& operator=(const BloomContext&) = delete;
+    BloomContext(BloomContext&&) = default;
+    BloomContext& operator=(BloomContext&&) = default;
+    
+    // Blooms `image` in place: scaled by kBloomMult and clamped to [0, 1]
+    void Bloom(MyImage<T>& image);
+    
+    // Blooms `image` straight to RGBA8 (`out` holds width * height pixels). The final
+    // upsample+blend, the bloom scale, the tone curve, the clamp and the quantization run
+    // as one sweep over the full-resolution level: each row is blended in a per-thread
+    // scratch row and converted right away, so `image` is read once and left unchanged.
+    void BloomToRGBA8(const MyImage<T>& image, Color* out, const BloomOutput& output = {});
+    
+    inline int GetWidth() const { return width_; }
+    inline int GetHeight() const { return height_; }
+    inline int GetChannels() const { return channels_; }
+    inline int GetLevels() const { return levels_; }
+    inline const BloomLayout& GetLayout() const { return layout_; }
+    inline const BloomPrefilter& GetPrefilter() const { return prefilter_; }
+    
+    // Takes effect from the next frame, nothing depends on it but the first DownSample
+    inline void SetPrefilter(const BloomPrefilter& prefilter) {
+        assert(!layout_.planar || !prefilter.IsEnabled());
+        prefilter_ = prefilter;
+    }
+    
+    // Keeps the coarse levels across frames (see BloomTemporal). The next frame rebuilds
+    // every level; so does the one after ResetTemporal(), e.g. at a scene cut.
+    void SetTemporal(const BloomTemporal& temporal);
+    inline void ResetTemporal() { temporal_valid_ = false; }
+    inline const BloomTemporal& GetTemporal() const { return temporal_; }
+    inline const BloomTemporalStats& GetTemporalStats() const { return temporal_stats_; }
+    
+    // While enabled, every frame records how long each level took in GetLevelMilliseconds():
+    // [0] the output rows (with the Upsample of level 1), [k] the DownSample into level k
+    // plus the Upsample of level k into level k - 1. Task times are summed over the threads
+    // and scaled to the frame's wall time. Interleaved layout only.
+    inline void SetLevelTiming(bool enabled) { level_timing_ = enabled; }
+    inline const std::vector<double>& GetLevelMilliseconds() const { return level_ms_; }
+    inline size_t GetArenaBytes() const {
+        size_t bytes = arena_.GetSize() * sizeof(T);
+        for (const BloomContext& plane : planes_) {
+            bytes += plane.GetArenaBytes();
+        }
+        return bytes;
+    }
+    
+private:
+    // Output pixels per wavefront task, small enough for a level's working rows to stay in L2
+    static constexpr int kTaskPixels = 16384;
+    
+    // Rows [row_begin, row_end) of one level, either downsampled from the level above
+    // or blended with the upsampled level below (level 0: the caller's output rows)
+    struct WavefrontTask {
+        int level;
+        bool upsample;
+        int row_begin;
+        int row_end;
+        int flag;                // Index of the task before ordering
+        int deps[3][2];          // Ranges [first, last] of flags to wait for
+    };
+    
+    int width_;
+    int height_;
+    int channels_;
+    int levels_;
+    BloomLayout layout_;
+    BloomPrefilter prefilter_;
+    int active_channels_;                    // Channels that get blurred
+    int scratch_threads_;
+    
+    ImageBuffer<T> arena_;                   // Every pyramid level plus the scratch rows
+    std::vector<MyImage<T>> pyramid_;        // pyramid_[k] is level k + 1, a view into arena_
+    std::vector<DownSampleAxis<T>> cols_;    // DownSample tap tables for pyramid_[k]
+    std::vector<DownSampleAxis<T>> rows_;
+    std::vector<ResampleTile> down_tiles_;   // [level] tile of its DownSample/Upsample tasks (see
+    std::vector<ResampleTile> up_tiles_;     // GetResamplePlan()), refreshed every frame
+    T* scratch_;                             // scratch_threads_ rows of width_ * channels_
+    size_t scratch_stride_;
+    std::vector<WavefrontTask> tasks_;       // Every task after the ones it depends on
+    TaskGraph graph_;                        // The dependencies of tasks_, by index
+    std::vector<std::atomic<int>> pending_;  // ThreadPool::Run() counters
+    
+    // Planar layout: a single-channel context and a full-resolution plane (in arena_) per
+    // blurred channel, the interleaved pyramid above stays empty
+    std::vector<BloomContext> planes_;
+    std::vector<MyImage<T>> plane_images_;
+    
+    // Temporal mode: levels temporal_level_..levels_ are candidates (0: off). For candidate
+    // k, sources_[k - temporal_level_] is level k - 1 as level k was last downsampled from,
+    // history_[...] level k after its last blend. Frames reuse levels reuse_from_..levels_.
+    BloomTemporal temporal_;
+    BloomTemporalStats temporal_stats_;
+    int temporal_level_ = 0;
+    int reuse_from_ = 0;
+    bool temporal_valid_ = false;
+    ImageBuffer<T> temporal_arena_;
+    std::vector<MyImage<T>> sources_;
+    std::vector<MyImage<T>> history_;
+    std::vector<int> reuse_frames_;          // Frames each candidate has been reused for
+    
+    bool level_timing_ = false;
+    std::vector<double> level_ms_;
+    std::vector<double> task_ms_;            // [thread * (levels + 1) + level] while timing
+    
+    // Copies the blurred channels of `image` into plane_images_ and blooms each plane up to
+    // its final blend
+    void BloomPlanes_(const MyImage<T>& image);
+    
+    // Zeroes the arena with the pool workers, each one the rows its first tasks write
+    void FirstTouch_();
+    
+    // Splits the levels into tasks and orders them depth first
+    void PlanWavefront_();
+    
+    // Runs tasks_ from `image`, final_row(i, col_begin, col_end, thread) produces that part of
+    // output row i from the blended level 1. Channels and SkipAlpha as in DownSampleRow.
+    template <int Channels, bool SkipAlpha, typename FinalRow>
+    void RunWavefront_(const MyImage<T>& image, const FinalRow& final_row);
+    
+    // Temporal mode, in the task of the first candidate: decides which candidates to reuse
+    // and downsamples the others. Single-threaded, the candidates are a few hundred pixels.
+    template <int Channels, bool SkipAlpha>
+    void DownSampleCandidates_();
+    
+    // Temporal mode: blends rebuilt candidate `level` with its history
+    void SmoothLevel_(int level);
+};
+
+template <typename T>
+BloomContext<T>::BloomContext(int width, int height, int channels, int levels, const BloomLayout& layout,
+                              const BloomPrefilter& prefilter)
+    : width_(width), height_(height), channels_(channels), levels_(levels), layout_(layout), prefilter_(prefilter),
+      active_channels_(layout.skip_alpha && (channels == 2 || channels == 4) ? channels - 1 : channels),
+      scratch_threads_(std::max(omp_get_max_threads(), ThreadPool::Get().GetThreadCount())), scratch_(nullptr),
+      scratch_stride_(0) {
+    // Each plane only sees its own channel, while the bright-pass needs all of them
+    assert(!layout.planar || !prefilter.IsEnabled());
+    
+    // The planar layout keeps its pyramids in the per-plane contexts
+    const int own_levels = layout.planar ? 0 : levels;
+    ArenaLayout arena(64 / sizeof(T));
+    arena.AddLevels(width, height, channels, own_levels);
+    scratch_stride_ = arena.RoundUp((size_t)width * channels);
+    const size_t scratch_offset = arena.Add((size_t)scratch_threads_ * scratch_stride_);
+    const size_t plane_size = arena.RoundUp((size_t)width * height);
+    const size_t planes_offset = arena.Add(layout.planar ? (size_t)active_channels_ * plane_size : 0);
+    
+    // From the default ImageAllocator, left untouched until FirstTouch_() places the pages
+    arena_ = ImageBuffer<T>(arena.total);
+    
+    if (layout.planar) {
+        planes_.reserve(active_channels_);
+        for (int p = 0; p < active_channels_; ++p) {
+            planes_.emplace_back(width, height, 1, levels);
+            plane_images_.emplace_back(width, height, 1, arena_.Get() + planes_offset + p * plane_size);
+        }
+    }
+    
+    pyramid_.reserve(own_levels);
+    down_tiles_.resize(own_levels + 1);
+    up_tiles_.resize(own_levels + 1);
+    cols_.reserve(own_levels);
+    rows_.reserve(own_levels);
+    int src_w = width;
+    int src_h = height;
+    for (const ArenaLayout::Level& level : arena.levels) {
+        pyramid_.emplace_back(level.width, level.height, channels, arena_.Get() + level.offset);
+        cols_.emplace_back(level.width, src_w, channels);
+        rows_.emplace_back(level.height, src_h, 1);
+        src_w = level.width;
+        src_h = level.height;
+    }
+    scratch_ = arena_.Get() + scratch_offset;
+    FirstTouch_();
+    
+    if (!layout.planar) {
+        PlanWavefront_();
+    }
+}
+
+template <typename T>
+void BloomContext<T>::FirstTouch_() {
+    // Zero-filled, so every page is touched here and not during the first frame. A page
+    // goes to the NUMA node of the thread that touches it first, and ThreadPool::Run()
+    // hands worker b the b-th block of the level 1 tasks, whose successors cover about the
+    // same fraction of every other level: block b of each level's rows is zeroed by worker b.
+    BLOOM_TRACE_SCOPE("BloomContext first touch", TraceArgs{.width = width_, .height = height_, .channels = channels_,
+                                                          .bytes = arena_.GetSize() * sizeof(T)});
+    ThreadPool::Get().ParallelBlocks([&](int block, int blocks) {
+        auto zero_rows = [&](MyImage<T>& image) {
+            const int begin = (int)((long long)image.height * block / blocks);
+            const int end = (int)((long long)image.height * (block + 1) / blocks);
+            std::fill(image.GetRow(begin), image.GetRow(end), T(0));
+        };
+        for (MyImage<T>& level : pyramid_) {
+            zero_rows(level);
+        }
+        for (MyImage<T>& plane : plane_images_) {
+            zero_rows(plane);
+        }
+        // Scratch row t belongs to worker t
+        const size_t begin = (size_t)scratch_threads_ * block / blocks;
+        const size_t end = (size_t)scratch_threads_ * (block + 1) / blocks;
+        std::fill(scratch_ + begin * scratch_stride_, scratch_ + end * scratch_stride_, T(0));
+    });
+}
+
+template <typename T>
+void BloomContext<T>::PlanWavefront_() {
+    const int n = (int)pyramid_.size();
+    auto width = [&](int k) { return k == 0 ? width_ : pyramid_[k - 1].width; };
+    auto height = [&](int k) { return k == 0 ? height_ : pyramid_[k - 1].height; };
+    
+    std::vector<int> chunk_rows(n + 1);
+    std::vector<int> chunks(n + 1);
+    for (int k = 0; k <= n; ++k) {
+        chunk_rows[k] = std::max(1, std::min(height(k), kTaskPixels / std::max(1, width(k))));
+        chunks[k] = (height(k) + chunk_rows[k] - 1) / chunk_rows[k];
+    }
+    
+    // One flag per task: downsampled rows of levels 1..n, then final rows of levels 0..n-1
+    // (and the output rows of level 0 without any levels)
+    std::vector<int> down_base(n + 1, 0);
+    std::vector<int> up_base(n + 1, 0);
+    int flags = 0;
+    for (int k = 1; k <= n; ++k) {
+        down_base[k] = flags;
+        flags += chunks[k];
+    }
+    for (int k = 0; k < std::max(n, 1); ++k) {
+        up_base[k] = flags;
+        flags += chunks[k];
+    }
+    
+    // Tasks indexed by their flag
+    std::vector<WavefrontTask> all(flags);
+    auto add_task = [&](int level, bool upsample, int chunk) -> WavefrontTask& {
+        WavefrontTask& task = all[(upsample ? up_base[level] : down_base[level]) + chunk];
+        task.level = level;
+        task.upsample = upsample;
+        task.row_begin = chunk * chunk_rows[level];
+        task.row_end = std::min(height(level), task.row_begin + chunk_rows[level]);
+        task.flag = (upsample ? up_base[level] : down_base[level]) + chunk;
+        for (auto& dep : task.deps) {
+            dep[0] = 0;
+            dep[1] = -1;
+        }
+        return task;
+    };
+    // Flags of the chunks of `level` holding rows [begin, end)
+    auto rows_dep = [&](int* dep, int base, int level, int begin, int end) {
+        dep[0] = base + begin / chunk_rows[level];
+        dep[1] = base + (end - 1) / chunk_rows[level];
+    };
+    
+    for (int k = 1; k <= n; ++k) {
+        for (int c = 0; c < chunks[k]; ++c) {
+            WavefrontTask& task = add_task(k, false, c);
+            if (k > 1) {
+                int a, b;
+                DownSampleSourceRows(rows_[k - 1], height(k - 1), task.row_begin, task.row_end, a, b);
+                rows_dep(task.deps[0], down_base[k - 1], k - 1, a, b);
+            }
+        }
+    }
+    for (int k = 0; k < std::max(n, 1); ++k) {
+        for (int c = 0; c < chunks[k]; ++c) {
+            WavefrontTask& task = add_task(k, true, c);
+            if (n == 0) {
+                continue;
+            }
+            
+            // Final rows of the level below (the coarsest level is final once downsampled)
+            int a, b;
+            UpsampleSourceRows(height(k + 1), height(k), task.row_begin, task.row_end, a, b);
+            rows_dep(task.deps[0], k + 1 == n ? down_base[k + 1] : up_base[k + 1], k + 1, a, b);
+            
+            // Its own rows must be downsampled, and every downsample reading them done
+            // before they are blended in place
+            if (k > 0) {
+                task.deps[1][0] = task.deps[1][1] = down_base[k] + c;
+            }
+            int first = chunks[k + 1];
+            int last = -1;
+            for (int d = 0; d < chunks[k + 1]; ++d) {
+                int r0 = d * chunk_rows[k + 1];
+                int r1 = std::min(height(k + 1), r0 + chunk_rows[k + 1]);
+                DownSampleSourceRows(rows_[k], height(k), r0, r1, a, b);
+                if (a < task.row_end && b > task.row_begin) {
+                    first = std::min(first, d);
+                    last = std::max(last, d);
+                }
+            }
+            if (first <= last) {
+                task.deps[2][0] = down_base[k + 1] + first;
+                task.deps[2][1] = down_base[k + 1] + last;
+            }
+        }
+    }
+    
+    // Depth first order: right after each task, every task of the next levels whose inputs
+    // are now all planned. Keeps the rows in flight close together across the levels.
+    std::vector<bool> planned(flags, false);
+    auto ready = [&](const WavefrontTask& task) {
+        for (const auto& dep : task.deps) {
+            for (int f = dep[0]; f <= dep[1]; ++f) {
+                if (!planned[f]) {
+                    return false;
+                }
+            }
+        }
+        return true;
+    };
+    auto plan = [&](int flag) {
+        tasks_.push_back(all[flag]);
+        planned[flag] = true;
+    };
+    
+    tasks_.reserve(flags);
+    std::vector<int> next(n + 1, 0);
+    for (int c = 0; n > 0 && c < chunks[1]; ++c) {
+        plan(down_base[1] + c);
+        for (int k = 2; k <= n; ++k) {
+            while (next[k] < chunks[k] && ready(all[down_base[k] + next[k]])) {
+                plan(down_base[k] + next[k]++);
+            }
+        }
+    }
+    std::fill(next.begin(), next.end(), 0);
+    int top = std::max(n - 1, 0);
+    for (int c = 0; c < chunks[top]; ++c) {
+        plan(up_base[top] + c);
+        for (int k = top - 1; k >= 0; --k) {
+            while (next[k] < chunks[k] && ready(all[up_base[k] + next[k]])) {
+                plan(up_base[k] + next[k]++);
+            }
+        }
+    }
+    assert((int)tasks_.size() == flags);
+    
+    std::vector<int> index(flags);
+    for (int t = 0; t < flags; ++t) {
+        index[tasks_[t].flag] = t;
+    }
+    std::vector<std::vector<int>> waits_for(flags);
+    for (int t = 0; t < flags; ++t) {
+        for (const auto& dep : tasks_[t].deps) {
+            for (int f = dep[0]; f <= dep[1]; ++f) {
+                waits_for[t].push_back(index[f]);
+            }
+        }
+    }
+    graph_ = TaskGraph::FromDependencies(std::move(waits_for));
+    pending_ = std::vector<std::atomic<int>>(flags);
+}
+
+template <typename T>
+template <int Channels, bool SkipAlpha, typename FinalRow>
+void BloomContext<T>::RunWavefront_(const MyImage<T>& image, const FinalRow& final_row) {
+    assert(image.width == width_ && image.height == height_ && image.channels == channels_);
+    
+    // Per level, from the tuning profile: the tile of its tasks, and the thread count of the
+    // whole frame
+    const int n = (int)pyramid_.size();
+    for (int k = 0; k <= n; ++k) {
+        const int w = k == 0 ? width_ : pyramid_[k - 1].width;
+        const int h = k == 0 ? height_ : pyramid_[k - 1].height;
+        down_tiles_[k] = GetResamplePlan(TunedKernel::DownSample, w, h, 0).tile;
+        up_tiles_[k] = GetResamplePlan(TunedKernel::Upsample, w, h, 0).tile;
+    }
+    const KernelTuning* frame = GetTuningProfile().Find(TunedKernel::Bloom, (long long)width_ * height_);
+    
+    const T threshold = T(prefilter_.threshold);
+    const T knee = T(prefilter_.threshold * prefilter_.knee);
+    
+    auto run_task = [&](int t, int thread) {
+        const WavefrontTask& task = tasks_[t];
+        
+        // The task's rows in blocks of the current tile shape (all of them by default)
+        const int level_width = task.level == 0 ? width_ : pyramid_[task.level - 1].width;
+        const ResampleTile& tile = task.upsample ? up_tiles_[task.level] : down_tiles_[task.level];
+        const TileGrid grid(tile, task.row_end - task.row_begin, task.row_begin, task.row_end, level_width);
+        if (!task.upsample && temporal_level_ > 0 && task.level >= temporal_level_) {
+            // Every candidate is a single task, the first one does them all
+            if (task.level == temporal_level_) {
+                DownSampleCandidates_<Channels, SkipAlpha>();
+            }
+        } else if (!task.upsample) {
+            const MyImage<T>& src = task.level == 1 ? image : pyramid_[task.level - 2];
+            MyImage<T>& dst = pyramid_[task.level - 1];
+            // Reads ~4 source samples per output sample, as DownSampleRows
+            BLOOM_TRACE_SCOPE("DownSample rows",
+                              TraceArgs{.level = task.level, .width = dst.width, .height = task.row_end - task.row_begin,
+                                        .channels = channels_,
+                                        .bytes = (size_t)(task.row_end - task.row_begin) * dst.width * channels_ * 5 *
+                                                 sizeof(T)});
+            const bool karis = task.level == 1 && prefilter_.karis;
+            const bool bright_pass = task.level == 1 && threshold > T(0);
+            for (int b = 0; b < grid.count; ++b) {
+                grid.ForEachRow(b, [&](int i, int col_begin, int col_end) {
+                    if (karis) {
+                        DownSampleRow<Channels, SkipAlpha, true>(src, dst, cols_[0], rows_[0], i,
+                                                                 col_begin, col_end);
+                    } else {
+                        DownSampleRow<Channels, SkipAlpha>(src, dst, cols_[task.level - 1],
+                                                           rows_[task.level - 1], i, col_begin, col_end);
+                    }
+                    // While the row is still in L1
+                    if (bright_pass) {
+                        BrightPassRow<Channels>(dst.GetRow(i), channels_, col_begin, col_end, threshold, knee);
+                    }
+                });
+            }
+        } else if (task.level > 0) {
+            // A reused level still holds its final rows from the previous frame
+            if (temporal_level_ > 0 && task.level >= reuse_from_) {
+                return;
+            }
+            MyImage<T>& dst = pyramid_[task.level - 1];
+            // The task's share of the level below, and its rows read and written, as UpsampleInto
+            BLOOM_TRACE_SCOPE("UpsampleBlend rows",
+                              TraceArgs{.level = task.level, .width = dst.width, .height = task.row_end - task.row_begin,
+                                        .channels = channels_,
+                                        .bytes = (pyramid_[task.level].GetSize() * (task.row_end - task.row_begin) /
+                                                      dst.height +
+                                                  (size_t)(task.row_end - task.row_begin) * dst.width * channels_ * 2) *
+                                                 sizeof(T)});
+            for (int b = 0; b < grid.count; ++b) {
+                grid.ForEachRow(b, [&](int i, int col_begin, int col_end) {
+                    UpsampleRow<true, Channels, SkipAlpha>(pyramid_[task.level], dst.GetRow(i), dst.width,
+                                                           dst.height, i, col_begin, col_end,
+                                                           T(kBloomLerpWeight));
+                });
+            }
+            if (temporal_level_ > 0 && task.level >= temporal_level_) {
+                SmoothLevel_(task.level);
+            }
+        } else {
+            // Input rows read, scratch rows written, and the task's share of level 1
+            BLOOM_TRACE_SCOPE("Output rows",
+                              TraceArgs{.level = 0, .width = width_, .height = task.row_end - task.row_begin,
+                                        .channels = channels_,
+                                        .bytes = ((pyramid_.empty() ? 0 : pyramid_[0].GetSize() *
+                                                                              (task.row_end - task.row_begin) / height_) +
+                                                  (size_t)(task.row_end - task.row_begin) * width_ * channels_ * 2) *
+                                                 sizeof(T)});
+            for (int b = 0; b < grid.count; ++b) {
+                grid.ForEachRow(b, [&](int i, int col_begin, int col_end) {
+                    final_row(i, col_begin, col_end, thread);
+                });
+            }
+        }
+    };
+    
+    // Small images in task order on the calling thread
+    auto run = [&](const auto& fn) {
+        if ((size_t)width_ * height_ > kTaskPixels) {
+            ThreadPool::Get().Run(graph_, pending_.data(), fn, frame ? frame->threads : 0);
+        } else {
+            for (int t = 0; t < (int)tasks_.size(); ++t) {
+                fn(t, 0);
+            }
+        }
+    };
+    
+    if (!level_timing_) {
+        run(run_task);
+    } else {
+        // Each task's time goes to the level it belongs to, see SetLevelTiming()
+        const auto frame_start = std::chrono::steady_clock::now();
+        task_ms_.assign((size_t)scratch_threads_ * (n + 1), 0.0);
+        run([&](int t, int thread) {
+            const auto start = std::chrono::steady_clock::now();
+            run_task(t, thread);
+            const WavefrontTask& task = tasks_[t];
+            const int level = task.upsample && task.level > 0 ? task.level + 1 : task.level;
+            task_ms_[(size_t)thread * (n + 1) + level] +=
+                std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        });
+        const double wall =
+            std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - frame_start).count();
+        
+        level_ms_.assign(n + 1, 0.0);
+        double total = 0.0;
+        for (size_t k = 0; k < task_ms_.size(); ++k) {
+            level_ms_[k % (n + 1)] += task_ms_[k];
+            total += task_ms_[k];
+        }
+        for (double& ms : level_ms_) {
+            ms = total > 0.0 ? ms * wall / total : 0.0;
+        }
+    }
+    temporal_valid_ = temporal_level_ > 0;
+}
+
+template <typename T>
+void BloomContext<T>::SetTemporal(const BloomTemporal& temporal) {
+    assert(!layout_.planar || !temporal.IsEnabled());
+    temporal_ = temporal;
+    temporal_stats_ = {};
+    temporal_level_ = 0;
+    temporal_valid_ = false;
+    sources_.clear();
+    history_.clear();
+    reuse_frames_.clear();
+    if (!temporal.IsEnabled() || layout_.planar) {
+        temporal_arena_ = {};
+        return;
+    }
+    
+    // Never level 1, which the prefilter belongs to. Candidates have to be a single task
+    // each (see PlanWavefront_), which the size limit keeps them anyway.
+    const int n = (int)pyramid_.size();
+    for (int k = n; k >= 2; --k) {
+        const MyImage<T>& level = pyramid_[k - 1];
+        if (std::max(level.width, level.height) > temporal.max_level_size ||
+            (size_t)level.width * level.height > kTaskPixels) {
+            break;
+        }
+        temporal_level_ = k;
+    }
+    if (temporal_level_ == 0) {
+        temporal_arena_ = {};
+        return;
+    }
+    
+    size_t total = 0;
+    for (int k = temporal_level_; k <= n; ++k) {
+        total += pyramid_[k - 2].GetSize() + pyramid_[k - 1].GetSize();
+    }
+    temporal_arena_ = ImageBuffer<T>(total);
+    T* data = temporal_arena_.Get();
+    for (int k = temporal_level_; k <= n; ++k) {
+        const MyImage<T>& source = pyramid_[k - 2];
+        const MyImage<T>& level = pyramid_[k - 1];
+        sources_.emplace_back(source.width, source.height, channels_, data);
+        data += source.GetSize();
+        history_.emplace_back(level.width, level.height, channels_, data);
+        data += level.GetSize();
+    }
+    reuse_frames_.assign(n - temporal_level_ + 1, 0);
+    temporal_stats_.candidate_levels = n - temporal_level_ + 1;
+}
+
+template <typename T>
+template <int Channels, bool SkipAlpha>
+void BloomContext<T>::DownSampleCandidates_() {
+    BLOOM_TRACE_SCOPE("DownSample candidates", TraceArgs{.level = temporal_level_});
+    const int n = (int)pyramid_.size();
+    reuse_from_ = n + 1;
+    for (int k = temporal_level_; k <= n; ++k) {
+        const int c = k - temporal_level_;
+        const MyImage<T>& source = pyramid_[k - 2];
+        MyImage<T>& saved = sources_[c];
+        
+        double change = 0.0;
+        if (temporal_valid_) {
+            const T* a = source.GetRawData();
+            const T* b = saved.GetRawData();
+            for (size_t e = 0; e < source.GetSize(); ++e) {
+                change += std::abs(double(a[e]) - double(b[e]));
+            }
+            change /= std::max<size_t>(source.GetSize(), 1);
+        }
+        if (k == temporal_level_) {
+            temporal_stats_.change = change;
+        }
+        
+        // An unchanged source leaves every coarser level unchanged too
+        if (temporal_valid_ && change <= temporal_.threshold && reuse_frames_[c] < temporal_.max_reuse_frames) {
+            reuse_from_ = k;
+            break;
+        }
+        std::copy(source.GetRawData(), source.GetRawData() + source.GetSize(), saved.GetRawData());
+        MyImage<T>& level = pyramid_[k - 1];
+        for (int i = 0; i < level.height; ++i) {
+            DownSampleRow<Channels, SkipAlpha>(source, level, cols_[k - 1], rows_[k - 1], i, 0, level.width);
+        }
+        reuse_frames_[c] = 0;
+        // The coarsest level has no blend to wait for
+        if (k == n) {
+            SmoothLevel_(k);
+        }
+    }
+    for (int k = reuse_from_; k <= n; ++k) {
+        ++reuse_frames_[k - temporal_level_];
+    }
+    temporal_stats_.reused_levels = n + 1 - reuse_from_;
+}
+
+template <typename T>
+void BloomContext<T>::SmoothLevel_(int level) {
+    MyImage<T>& image = pyramid_[level - 1];
+    T* history = history_[level - temporal_level_].GetRawData();
+    T* data = image.GetRawData();
+    const T s = T(temporal_.smoothing);
+    if (temporal_valid_ && s > T(0)) {
+        for (size_t e = 0; e < image.GetSize(); ++e) {
+            data[e] = data[e] * (T(1) - s) + history[e] * s;
+        }
+    }
+    std::copy(data, data + image.GetSize(), history);
+}
+
+template <typename T>
+void BloomContext<T>::BloomPlanes_(const MyImage<T>& image) {
+    assert(image.width == width_ && image.height == height_ && image.channels == channels_);
+    const int w = width_;
+    const int c = channels_;
+    
+    {
+        BLOOM_TRACE_SCOPE("Split planes", TraceArgs{.width = w, .height = height_, .channels = active_channels_,
+                                                    .bytes = 2 * (size_t)w * height_ * active_channels_ * sizeof(T)});
+        #pragma omp parallel for schedule(static) if(height_ > 64)
+        for (int i = 0; i < height_; ++i) {
+            const T* src = image.GetRow(i);
+            for (int p = 0; p < active_channels_; ++p) {
+                T* dst = plane_images_[p].GetRow(i);
+                for (int x = 0; x < w; ++x) {
+                    dst[x] = src[x * c + p];
+                }
+            }
+        }
+    }
+    
+    // Each plane in place, up to and including its final blend
+    for (int p = 0; p < active_channels_; ++p) {
+        BloomContext& plane = planes_[p];
+        MyImage<T>& plane_image = plane_images_[p];
+        plane.template RunWavefront_<1, false>(plane_image, [&](int i, int col_begin, int col_end, int) {
+            if (plane.levels_ > 0) {
+                UpsampleRow<true, 1>(plane.pyramid_[0], plane_image.GetRow(i), w, height_, i, col_begin, col_end,
+                                     T(kBloomLerpWeight));
+            }
+        });
+    }
+}
+
+template <typename T>
+void BloomContext<T>::Bloom(MyImage<T>& image) {
+    BLOOM_TRACE_SCOPE("Bloom", TraceArgs{.width = width_, .height = height_, .channels = channels_});
+    constexpr T mult = T(kBloomMult);
+    
+    if (layout_.planar) {
+        BloomPlanes_(image);
+        
+        // Merge: blurred channels from their planes, a skipped alpha from the input
+        BLOOM_TRACE_SCOPE("Merge planes", TraceArgs{.width = width_, .height = height_, .channels = channels_});
+        const int c = channels_;
+        #pragma omp parallel for schedule(static) if(height_ > 64)
+        for (int i = 0; i < height_; ++i) {
+            T* row = image.GetRow(i);
+            for (int p = 0; p < c; ++p) {
+                const T* src = p < active_channels_ ? plane_images_[p].GetRow(i) : nullptr;
+                for (int x = 0; x < width_; ++x) {
+                    T v = src ? src[x] : row[x * c + p];
+                    row[x * c + p] = std::max(T(0), std::min(v * mult, T(1)));
+                }
+            }
+        }
+        return;
+    }
+    
+    // Final blend, multiplication and clamping, in place
+    DispatchChannels(channels_, active_channels_ < channels_, [&](auto channels, auto skip_alpha) {
+        constexpr int C = decltype(channels)::value;
+        constexpr bool S = decltype(skip_alpha)::value;
+        RunWavefront_<C, S>(image, [&](int i, int col_begin, int col_end, int) {
+            T* row = image.GetRow(i);
+            if (levels_ > 0) {
+                UpsampleRow<true, C, S>(pyramid_[0], row, width_, height_, i, col_begin, col_end,
+                                        T(kBloomLerpWeight));
+            }
+            for (int k = col_begin * channels_; k < col_end * channels_; ++k) {
+                row[k] = std::max(T(0), std::min(row[k] * mult, T(1)));
+            }
+        });
+    });
+}
+
+template <typename T>
+void BloomContext<T>::BloomToRGBA8(const MyImage<T>& image, Color* out, const BloomOutput& output) {
+    BLOOM_TRACE_SCOPE("BloomToRGBA8", TraceArgs{.width = width_, .height = height_, .channels = channels_});
+    
+    int w = width_;
+    int c = channels_;
+    T mult = T(output.mult);
+    
+    if (layout_.planar) {
+        BloomPlanes_(image);
+        
+        // Interleave the planes (and a skipped alpha) into a scratch row and convert it
+        BLOOM_TRACE_SCOPE("Merge planes + RGBA8", TraceArgs{.width = w, .height = height_, .channels = c});
+        #pragma omp parallel num_threads(scratch_threads_) if(height_ > 64)
+        {
+            T* row = scratch_ + omp_get_thread_num() * scratch_stride_;
+            
+            #pragma omp for schedule(static)
+            for (int i = 0; i < height_; ++i) {
+                const T* src_row = image.GetRow(i);
+                for (int p = 0; p < c; ++p) {
+                    const T* src = p < active_channels_ ? plane_images_[p].GetRow(i) : nullptr;
+                    for (int x = 0; x < w; ++x) {
+                        row[x * c + p] = src ? src[x] : src_row[x * c + p];
+                    }
+                }
+                ConvertRowToRGBA8(row, out + (ptrdiff_t)i * w, w, c, mult, output.tone_map);
+            }
+        }
+        return;
+    }
+    
+    DispatchChannels(channels_, active_channels_ < channels_, [&](auto channels, auto skip_alpha) {
+        constexpr int C = decltype(channels)::value;
+        constexpr bool S = decltype(skip_alpha)::value;
+        RunWavefront_<C, S>(image, [&](int i, int col_begin, int col_end, int thread) {
+            T* row = scratch_ + thread * scratch_stride_;
+            const T* src_row = image.GetRow(i);
+            std::copy(src_row + col_begin * c, src_row + col_end * c, row + col_begin * c);
+            if (levels_ > 0) {
+                UpsampleRow<true, C, S>(pyramid_[0], row, w, height_, i, col_begin, col_end, T(kBloomLerpWeight));
+            }
+            ConvertRowToRGBA8(row + col_begin * c, out + (ptrdiff_t)i * w + col_begin, col_end - col_begin, c,
+                              mult, output.tone_map);
+        });
+    });
+}
+
+// One-shot helpers: set up a context for `image` and run it once (allocates every call,
+// keep a BloomContext around for repeated frames)
+template <typename T>
+void Bloom(MyImage<T>& image, int samples = 8) {
+    BloomContext<T> context(image.width, image.height, image.channels, samples);
+    context.Bloom(image);
+}
+
+template <typename T>
+void BloomToRGBA8(const MyImage<T>& image, Color* out, const BloomOutput& output = {}, int samples = 8) {
+    BloomContext<T> context(image.width, image.height, image.channels, samples);
+    context.BloomToRGBA8(image, out, output);
+}
@@ -0,0 +1,126 @@
+#pragma once
+#include <Bloom.h>
+#include <MyImage.h>
+#include <Trace.h>
+#include <algorithm>
+#include <memory>
+#include <vector>
+#include <omp.h>
+
+// Bloom for many independent images at once, e.g. a folder of thumbnails.
+//
+// Row-level parallelism doesn't pay off for small images: a 256x256 level has a few
+// hundred rows at most, and the fork/join or task overhead of every level is a large
+// part of the work. A batch instead runs whole images concurrently, one image per thread
+// at a time with single-threaded kernels, so threads only meet once per image. Images can
+// all have different sizes and channel counts.
+//
+// Images above kImagePixels, and every image of a batch smaller than the thread count,
+// are bloomed one after another with all threads each, as BloomContext would.
+//
+// Every thread keeps the context of its last image and only builds a new one for an image
+// of another shape, so a batch of same-sized images allocates once per thread.
+template <typename T = float>
+class BloomBatch {
+public:
+    // Above this an image gets every thread to itself
+    static constexpr size_t kImagePixels = 1024 * 1024;
+
+    explicit BloomBatch(int levels = 8) : levels_(levels) {}
+
+    // Blooms every image in place, like BloomContext::Bloom()
+    void Bloom(MyImage<T>* const* images, size_t count);
+    void Bloom(std::vector<MyImage<T>>& images);
+
+    // Blooms image k straight to RGBA8 in outs[k] (image width * height pixels each), like
+    // BloomContext::BloomToRGBA8()
+    void BloomToRGBA8(const MyImage<T>* const* images, Color* const* outs, size_t count,
+                      const BloomOutput& output = {});
+
+    inline int GetLevels() const { return levels_; }
+
+private:
+    int levels_;
+    std::vector<std::unique_ptr<BloomContext<T>>> contexts_;   // Per thread, the last shape it saw
+    std::unique_ptr<BloomContext<T>> large_;                   // For the images that get every thread
+
+    // A context for `image` in `slot`, rebuilt when the shape changed
+    BloomContext<T>& GetContext_(std::unique_ptr<BloomContext<T>>& slot, const MyImage<T>& image);
+
+    // Runs fn(context, k) for every image k
+    template <typename Fn>
+    void Run_(const MyImage<T>* const* images, size_t count, const Fn& fn);
+};
+
+template <typename T>
+BloomContext<T>& BloomBatch<T>::GetContext_(std::unique_ptr<BloomContext<T>>& slot, const MyImage<T>& image) {
+    if (!slot || slot->GetWidth() != image.width || slot->GetHeight() != image.height ||
+        slot->GetChannels() != image.channels) {
+        slot = std::make_unique<BloomContext<T>>(image.width, image.height, image.channels, levels_);
+    }
+    return *slot;
+}
+
+template <typename T>
+template <typename Fn>
+void BloomBatch<T>::Run_(const MyImage<T>* const* images, size_t count, const Fn& fn) {
+    BLOOM_TRACE_SCOPE("BloomBatch");
+    const int threads = omp_get_max_threads();
+
+    // Small images of a batch that fills every thread, largest first so the tail is short
+    std::vector<size_t> small;
+    std::vector<size_t> large;
+    for (size_t k = 0; k < count; ++k) {
+        const size_t pixels = (size_t)images[k]->width * images[k]->height;
+        (pixels <= kImagePixels && count >= (size_t)threads ? small : large).push_back(k);
+    }
+    std::stable_sort(small.begin(), small.end(), [&](size_t a, size_t b) {
+        return (size_t)images[a]->width * images[a]->height > (size_t)images[b]->width * images[b]->height;
+    });
+
+    for (size_t k : large) {
+        fn(GetContext_(large_, *images[k]), k);
+    }
+
+    if (small.empty()) {
+        return;
+    }
+    if ((int)contexts_.size() < threads) {
+        contexts_.resize(threads);
+    }
+    #pragma omp parallel num_threads(threads)
+    {
+        // Kernels and the ThreadPool run on this thread only (see ThreadPool::Run())
+        omp_set_num_threads(1);
+        std::unique_ptr<BloomContext<T>>& slot = contexts_[omp_get_thread_num()];
+
+        #pragma omp for schedule(dynamic, 1)
+        for (size_t s = 0; s < small.size(); ++s) {
+            const size_t k = small[s];
+            fn(GetContext_(slot, *images[k]), k);
+        }
+    }
+}
+
+template <typename T>
+void BloomBatch<T>::Bloom(MyImage<T>* const* images, size_t count) {
+    Run_(images, count, [&](BloomContext<T>& context, size_t k) { context.Bloom(*images[k]); });
+}
+
+template <typename T>
+void BloomBatch<T>::Bloom(std::vector<MyImage<T>>& images) {
+    std::vector<MyImage<T>*> pointers;
+    pointers.reserve(images.size());
+    for (MyImage<T>& image : images) {
+        pointers.push_back(&image);
+    }
+    Bloom(pointers.data(), pointers.size());
+}
+
+template <typename T>
+void BloomBatch<T>::BloomToRGBA8(const MyImage<T>* const* images, Color* const* outs, size_t count,
+                                 const BloomOutput& output) {
+    Run_(images, count, [&](BloomContext<T>& context, size_t k) {
+        context.BloomToRGBA8(*images[k], outs[k], output);
+    });
+}
@@ -0,0 +1,241 @@
+#pragma once
+#include <Bloom.h>
+#include <FixedBloom.h>
+#include <MyImage.h>
+#include <Trace.h>
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <memory>
+#include <vector>
+
+// Bloom under a frame deadline, for live previews where hitting the deadline matters more
+// than bit-exact output.
+//
+// The first frame calibrates: one run of each precision with every allowed level, with
+// level timing on (see BloomContext::SetLevelTiming()), gives the cost of each level. The
+// predicted time of n levels is the output stage plus the first n level costs. The
+// setting with the most levels predicted to fit the budget wins, the faster precision
+// among equals. If nothing fits, the cheapest one runs.
+//
+// Every later frame is timed, and the running ratio of measured to predicted time scales
+// every prediction, of the settings that don't run too. A slow stretch then drops a
+// level, and its end brings the level back. The choice is made again after every frame,
+// in both directions.
+
+enum class BloomPrecision {
+    Float,      // BloomContext<float>, the samples converted from 8-bit first
+    Fixed16,    // FixedBloomContext, straight from the 8-bit samples
+};
+
+inline const char* GetPrecisionName(BloomPrecision precision) {
+    return precision == BloomPrecision::Float ? "float" : "fixed16";
+}
+
+struct BloomBudget {
+    double milliseconds = 8.0;      // Frame deadline
+    int max_levels = 8;
+    int min_level_size = 8;         // Smallest width or height of the coarsest level
+};
+
+// Settings picked by BudgetBloomContext
+struct BloomBudgetChoice {
+    int levels = 0;
+    BloomPrecision precision = BloomPrecision::Fixed16;
+    int coarsest_width = 0;         // Size of the coarsest level
+    int coarsest_height = 0;
+    double expected_ms = 0.0;       // Predicted frame time of these settings
+    bool meets_budget = false;
+};
+
+class BudgetBloomContext {
+public:
+    BudgetBloomContext(int width, int height, int channels, const BloomBudget& budget = {});
+
+    // Blooms width * height * channels interleaved 8-bit samples to RGBA8 (width * height
+    // pixels). The first call also calibrates, see above.
+    void BloomToRGBA8(const unsigned char* src, Color* out, const BloomOutput& output = {});
+
+    inline const BloomBudgetChoice& GetChoice() const { return choice_; }
+    inline double GetLastMilliseconds() const { return last_ms_; }
+
+    // Levels allowed by min_level_size, the candidates calibration measures
+    inline int GetMaxLevels() const { return max_levels_; }
+
+    // Predicted frame time of `levels` levels in `precision`, 0 before calibration
+    double GetCost(int levels, BloomPrecision precision) const;
+
+private:
+    // Weight of the latest frame in the running ratio, which then covers about 8 frames
+    static constexpr double kAverageWeight = 0.125;
+
+    // More levels only once they are predicted to leave this much of the budget, so the
+    // choice doesn't flip every frame between two settings right at the deadline
+    static constexpr double kPromoteMargin = 0.9;
+
+    int width_;
+    int height_;
+    int channels_;
+    BloomBudget budget_;
+    int max_levels_;
+    std::vector<std::array<double, 2>> level_costs_;  // [level][precision] ms, 0: output stage
+    double scale_ = 1.0;                        // Running ratio of measured to predicted time
+    bool cold_ = false;                         // The context was just built, its frame doesn't count
+    BloomBudgetChoice choice_;
+    double last_ms_ = 0.0;
+
+    // Only the chosen configuration is kept
+    std::unique_ptr<BloomContext<float>> float_context_;
+    std::unique_ptr<FixedBloomContext> fixed_context_;
+    MyImage<float> image_;                      // Float input, converted from the 8-bit samples
+
+    void Calibrate_(const unsigned char* src, Color* out, const BloomOutput& output);
+    void Choose_();
+    void Build_(int levels, BloomPrecision precision);
+    void Run_(const unsigned char* src, Color* out, const BloomOutput& output);
+};
+
+inline BudgetBloomContext::BudgetBloomContext(int width, int height, int channels, const BloomBudget& budget)
+    : width_(width), height_(height), channels_(channels), budget_(budget), max_levels_(0),
+      image_(width, height, channels, ImageInit::Uninitialized) {
+    int w = DownSampledSize(width);
+    int h = DownSampledSize(height);
+    while (max_levels_ < budget.max_levels && std::min(w, h) >= budget.min_level_size) {
+        ++max_levels_;
+        w = DownSampledSize(w);
+        h = DownSampledSize(h);
+    }
+    // Always at least one level
+    max_levels_ = std::max(max_levels_, 1);
+}
+
+inline void BudgetBloomContext::Build_(int levels, BloomPrecision precision) {
+    float_context_.reset();
+    fixed_context_.reset();
+    if (precision == BloomPrecision::Float) {
+        float_context_ = std::make_unique<BloomContext<float>>(width_, height_, channels_, levels);
+    } else {
+        fixed_context_ = std::make_unique<FixedBloomContext>(width_, height_, channels_, levels);
+    }
+}
+
+inline void BudgetBloomContext::Run_(const unsigned char* src, Color* out, const BloomOutput& output) {
+    if (fixed_context_) {
+        fixed_context_->BloomToRGBA8(src, out, output);
+        return;
+    }
+
+    float* data = image_.GetRawData();
+    const ptrdiff_t size = (ptrdiff_t)image_.GetSize();
+    #pragma omp parallel for schedule(static) if(size > 65536)
+    for (ptrdiff_t k = 0; k < size; ++k) {
+        data[k] = src[k] * (1.0f / 255.0f);
+    }
+    float_context_->BloomToRGBA8(image_, out, output);
+}
+
+inline double BudgetBloomContext::GetCost(int levels, BloomPrecision precision) const {
+    if (levels < 1 || levels >= (int)level_costs_.size()) {
+        return 0.0;
+    }
+    double ms = 0.0;
+    for (int k = 0; k <= levels; ++k) {
+        ms += level_costs_[k][(int)precision];
+    }
+    return ms * scale_;
+}
+
+inline void BudgetBloomContext::Calibrate_(const unsigned char* src, Color* out, const BloomOutput& output) {
+    BLOOM_TRACE_SCOPE("Budget calibration", TraceArgs{.width = width_, .height = height_, .channels = channels_});
+    level_costs_.assign(max_levels_ + 1, {0.0, 0.0});
+    for (BloomPrecision precision : {BloomPrecision::Float, BloomPrecision::Fixed16}) {
+        Build_(max_levels_, precision);
+        if (float_context_) {
+            float_context_->SetLevelTiming(true);
+        } else {
+            fixed_context_->SetLevelTiming(true);
+        }
+        auto start = std::chrono::steady_clock::now();
+        Run_(src, out, output);
+        const double wall = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+        // The 8-bit to float conversion, outside the context, counts as output stage
+        const std::vector<double>& ms = float_context_ ? float_context_->GetLevelMilliseconds()
+                                                       : fixed_context_->GetLevelMilliseconds();
+        double timed = 0.0;
+        for (int k = 0; k <= max_levels_; ++k) {
+            level_costs_[k][(int)precision] = ms[k];
+            timed += ms[k];
+        }
+        level_costs_[0][(int)precision] += std::max(0.0, wall - timed);
+        if (float_context_) {
+            float_context_->SetLevelTiming(false);
+        } else {
+            fixed_context_->SetLevelTiming(false);
+        }
+    }
+    scale_ = 1.0;
+}
+
+inline void BudgetBloomContext::Choose_() {
+    BloomBudgetChoice best;
+    bool found = false;
+    BloomBudgetChoice fallback;
+    for (int levels = 1; levels <= max_levels_; ++levels) {
+        const double limit = budget_.milliseconds * (levels > choice_.levels ? kPromoteMargin : 1.0);
+        for (BloomPrecision precision : {BloomPrecision::Float, BloomPrecision::Fixed16}) {
+            const double ms = GetCost(levels, precision);
+            if (ms <= limit && (!found || levels > best.levels || (levels == best.levels && ms < best.expected_ms))) {
+                best.levels = levels;
+                best.precision = precision;
+                best.expected_ms = ms;
+                found = true;
+            }
+            if (fallback.levels == 0 || ms < fallback.expected_ms) {
+                fallback.levels = levels;
+                fallback.precision = precision;
+                fallback.expected_ms = ms;
+            }
+        }
+    }
+
+    BloomBudgetChoice next = found ? best : fallback;
+    next.meets_budget = found;
+    next.coarsest_width = width_;
+    next.coarsest_height = height_;
+    for (int k = 0; k < next.levels; ++k) {
+        next.coarsest_width = DownSampledSize(next.coarsest_width);
+        next.coarsest_height = DownSampledSize(next.coarsest_height);
+    }
+    // Calibration leaves the last configuration it timed built
+    const bool built = next.precision == BloomPrecision::Float
+                           ? float_context_ && float_context_->GetLevels() == next.levels
+                           : fixed_context_ && fixed_context_->GetLevels() == next.levels;
+    if (!built) {
+        Build_(next.levels, next.precision);
+        cold_ = true;
+    }
+    choice_ = next;
+}
+
+inline void BudgetBloomContext::BloomToRGBA8(const unsigned char* src, Color* out, const BloomOutput& output) {
+    if (level_costs_.empty()) {
+        Calibrate_(src, out, output);
+        Choose_();
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    Run_(src, out, output);
+    last_ms_ = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    // The first frame of a new context pays for its cold caches and pages
+    if (cold_) {
+        cold_ = false;
+        return;
+    }
+    const double predicted = GetCost(choice_.levels, choice_.precision) / scale_;
+    if (predicted > 0.0) {
+        scale_ += (last_ms_ / predicted - scale_) * kAverageWeight;
+    }
+    Choose_();
+}
@@ -0,0 +1,377 @@
+#pragma once
+#include <Bloom.h>
+#include <MyImage.h>
+#include <Trace.h>
+#include <assert.h>
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <omp.h>
+
+// Bloom in 16-bit fixed point, straight from 8-bit samples.
+//
+// Pyramid levels hold uint16_t samples with 65535 as 1.0, so an 8-bit sample b is exactly
+// b * 257 and a level takes half the memory of a float one. DownSample, Upsample and the
+// blend use integer weights, in a separable form that adds up the same taps in another
+// order:
+//   DownSample  the 13 taps are two grids with one weight each, the 4 inner taps at +-1
+//               (0.125) and the 9 outer ones at 0, +-2 (0.0555555). The vertical lerps of
+//               a row are summed per grid first, over contiguous samples, which leaves 5
+//               horizontal lerps per output sample instead of 13 bilinear taps.
+//   Upsample    the 3x3 tent is (1, 2, 1) / 4 along each axis, 3 vertical lerps per source
+//               sample and 3 horizontal ones per output sample instead of 9 bilinear taps.
+// Texel positions come from the same double arithmetic as BloomContext<double>, and the
+// RGBA8 output stays within 1 LSB of it for the same 8-bit input.
+
+constexpr uint32_t kFixedOne = 65535;                       // 1.0
+
+// Bilinear weights: 13 bits keep every lerp of the widest sums below 2^32
+constexpr int kFixedFracBits = 13;
+constexpr uint32_t kFixedFracOne = 1u << kFixedFracBits;
+
+// DownSample tap weights, applied to 64-bit sums
+constexpr int kFixedWeightBits = 24;
+constexpr uint64_t kFixedInnerWeight = (uint64_t)(0.125 * (1 << kFixedWeightBits) + 0.5);
+constexpr uint64_t kFixedOuterWeight = (uint64_t)(0.0555555 * (1 << kFixedWeightBits) + 0.5);
+
+// kBloomLerpWeight
+constexpr int kFixedBlendBits = 15;
+constexpr uint32_t kFixedBlendOne = 1u << kFixedBlendBits;
+constexpr uint32_t kFixedBlendWeight = (uint32_t)(kBloomLerpWeight * kFixedBlendOne + 0.5);
+
+inline uint32_t FixedLerp(uint32_t lo, uint32_t hi, uint32_t frac) {
+    return (lo * (kFixedFracOne - frac) + hi * frac + kFixedFracOne / 2) >> kFixedFracBits;
+}
+
+// Bilinear tap positions along one axis, `taps` offsets (-taps / 2 .. taps / 2 output pixels)
+// around pos + center, clamped to the image. center is 0.5 for DownSample (pixel centers)
+// and 0 for Upsample, as in the float kernels.
+struct FixedAxis {
+    int taps;
+    std::vector<int> lo;            // [pos * taps + tap] lower texel, times `scale`
+    std::vector<int> hi;            // ... and the upper one
+    std::vector<uint16_t> frac;     // Weight of the upper texel, kFixedFracBits
+
+    FixedAxis(int new_size, int src_size, int scale, double center, int taps)
+        : taps(taps), lo((size_t)new_size * taps), hi((size_t)new_size * taps), frac((size_t)new_size * taps) {
+        double inv_new_size = 1.0 / new_size;
+        for (int pos = 0; pos < new_size; ++pos) {
+            for (int k = 0; k < taps; ++k) {
+                double u = (pos + center + (k - taps / 2)) * inv_new_size;
+                u = std::max(0.0, std::min(u, 1.0));
+                double p = u * (src_size - 1);
+                int p0 = (int)p;
+                int p1 = std::min(p0 + 1, src_size - 1);
+
+                lo[(size_t)pos * taps + k] = p0 * scale;
+                hi[(size_t)pos * taps + k] = p1 * scale;
+                frac[(size_t)pos * taps + k] = (uint16_t)((p - p0) * kFixedFracOne + 0.5);
+            }
+        }
+    }
+};
+
+// Row i of DownSample(src) into dst_row. Samples of `src` times `scale` are 16-bit ones
+// (257 for bytes). `inner` and `outer` are scratch rows of src_width * channels.
+// Channels as in DownSampleRow.
+template <int Channels, typename Src>
+void FixedDownSampleRow(const Src* src, int src_width, int channels, uint32_t scale,
+                        uint16_t* dst_row, int new_width, const FixedAxis& cols, const FixedAxis& rows,
+                        int i, uint32_t* inner, uint32_t* outer) {
+    assert(cols.taps == 5 && rows.taps == 5);
+    const int c = Channels > 0 ? Channels : channels;
+    const ptrdiff_t n = (ptrdiff_t)src_width * c;
+
+    // Vertical lerps of the 5 tap rows, summed per grid (<= 2 and 3 * kFixedOne)
+    const Src* row_lo[5];
+    const Src* row_hi[5];
+    uint32_t fy[5];
+    for (int k = 0; k < 5; ++k) {
+        row_lo[k] = src + rows.lo[(size_t)i * 5 + k] * n;
+        row_hi[k] = src + rows.hi[(size_t)i * 5 + k] * n;
+        fy[k] = rows.frac[(size_t)i * 5 + k];
+    }
+    for (ptrdiff_t x = 0; x < n; ++x) {
+        uint32_t v[5];
+        for (int k = 0; k < 5; ++k) {
+            v[k] = FixedLerp(row_lo[k][x] * scale, row_hi[k][x] * scale, fy[k]);
+        }
+        inner[x] = v[1] + v[3];
+        outer[x] = v[0] + v[2] + v[4];
+    }
+
+    for (int j = 0; j < new_width; ++j) {
+        const int* x_lo = &cols.lo[(size_t)j * 5];
+        const int* x_hi = &cols.hi[(size_t)j * 5];
+        const uint16_t* fx = &cols.frac[(size_t)j * 5];
+        uint16_t* dst = dst_row + (ptrdiff_t)j * c;
+
+        for (int ch = 0; ch < c; ++ch) {
+            uint64_t a = FixedLerp(inner[x_lo[1] + ch], inner[x_hi[1] + ch], fx[1]) +
+                         FixedLerp(inner[x_lo[3] + ch], inner[x_hi[3] + ch], fx[3]);
+            uint64_t b = FixedLerp(outer[x_lo[0] + ch], outer[x_hi[0] + ch], fx[0]) +
+                         FixedLerp(outer[x_lo[2] + ch], outer[x_hi[2] + ch], fx[2]) +
+                         FixedLerp(outer[x_lo[4] + ch], outer[x_hi[4] + ch], fx[4]);
+            uint64_t sum = (a * kFixedInnerWeight + b * kFixedOuterWeight + (1u << (kFixedWeightBits - 1))) >>
+                           kFixedWeightBits;
+            dst[ch] = (uint16_t)std::min<uint64_t>(sum, kFixedOne);
+        }
+    }
+}
+
+// Row i of Upsample(src) blended with base_row into dst_row, like UpsampleRow<true>:
+// dst = upsampled * (1 - t) + base * t with t = kBloomLerpWeight. base_row times
+// base_scale is 16-bit, and may be dst_row itself. `vertical` is a scratch row of
+// src_width * channels.
+template <int Channels, typename Base>
+void FixedUpsampleBlendRow(const uint16_t* src, int src_width, int channels, const Base* base_row,
+                           uint32_t base_scale, uint16_t* dst_row, int new_width,
+                           const FixedAxis& cols, const FixedAxis& rows, int i, uint32_t* vertical) {
+    assert(cols.taps == 3 && rows.taps == 3);
+    const int c = Channels > 0 ? Channels : channels;
+    const ptrdiff_t n = (ptrdiff_t)src_width * c;
+
+    // (1, 2, 1) weighted vertical lerps (<= 4 * kFixedOne)
+    const uint16_t* row_lo[3];
+    const uint16_t* row_hi[3];
+    uint32_t fy[3];
+    for (int k = 0; k < 3; ++k) {
+        row_lo[k] = src + rows.lo[(size_t)i * 3 + k] * n;
+        row_hi[k] = src + rows.hi[(size_t)i * 3 + k] * n;
+        fy[k] = rows.frac[(size_t)i * 3 + k];
+    }
+    for (ptrdiff_t x = 0; x < n; ++x) {
+        vertical[x] = FixedLerp(row_lo[0][x], row_hi[0][x], fy[0]) +
+                      2 * FixedLerp(row_lo[1][x], row_hi[1][x], fy[1]) +
+                      FixedLerp(row_lo[2][x], row_hi[2][x], fy[2]);
+    }
+
+    for (int j = 0; j < new_width; ++j) {
+        const int* x_lo = &cols.lo[(size_t)j * 3];
+        const int* x_hi = &cols.hi[(size_t)j * 3];
+        const uint16_t* fx = &cols.frac[(size_t)j * 3];
+        const ptrdiff_t p = (ptrdiff_t)j * c;
+
+        for (int ch = 0; ch < c; ++ch) {
+            uint32_t sum = FixedLerp(vertical[x_lo[0] + ch], vertical[x_hi[0] + ch], fx[0]) +
+                           2 * FixedLerp(vertical[x_lo[1] + ch], vertical[x_hi[1] + ch], fx[1]) +
+                           FixedLerp(vertical[x_lo[2] + ch], vertical[x_hi[2] + ch], fx[2]);
+            uint32_t upsampled = (sum + 8) >> 4;
+            uint32_t base = base_row[p + ch] * base_scale;
+            dst_row[p + ch] = (uint16_t)((upsampled * (kFixedBlendOne - kFixedBlendWeight) +
+                                          base * kFixedBlendWeight + kFixedBlendOne / 2) >> kFixedBlendBits);
+        }
+    }
+}
+
+// Reusable fixed-point bloom engine for one (width, height, channels, levels) configuration,
+// the counterpart of BloomContext for 8-bit sources. Everything is allocated by the
+// constructor, BloomToRGBA8() allocates nothing. Levels are built one after the other,
+// each one row-parallel.
+class FixedBloomContext {
+public:
+    FixedBloomContext(int width, int height, int channels, int levels = 8);
+
+    // Levels point into arena_
+    FixedBloomContext(const FixedBloomContext&) = delete;
+    FixedBloomContext& operator=(const FixedBloomContext&) = delete;
+    FixedBloomContext(FixedBloomContext&&) = default;
+    FixedBloomContext& operator=(FixedBloomContext&&) = default;
+
+    // Blooms width * height * channels interleaved 8-bit samples to RGBA8 (width * height
+    // pixels), same output stage as BloomContext::BloomToRGBA8()
+    void BloomToRGBA8(const unsigned char* src, Color* out, const BloomOutput& output = {});
+
+    inline int GetWidth() const { return width_; }
+    inline int GetHeight() const { return height_; }
+    inline int GetChannels() const { return channels_; }
+    inline int GetLevels() const { return levels_; }
+    inline size_t GetArenaBytes() const {
+        return arena_.GetSize() * sizeof(uint16_t) + scratch_.size() * sizeof(uint32_t) +
+               float_rows_.size() * sizeof(float);
+    }
+
+    // Per-level frame times, as BloomContext::SetLevelTiming()
+    inline void SetLevelTiming(bool enabled) { level_timing_ = enabled; }
+    inline const std::vector<double>& GetLevelMilliseconds() const { return level_ms_; }
+
+private:
+    struct Level {
+        int width;
+        int height;
+        uint16_t* data;
+    };
+
+    int width_;
+    int height_;
+    int channels_;
+    int levels_;
+    int threads_;
+
+    ImageBuffer<uint16_t> arena_;       // Every pyramid level plus the 16-bit output rows
+    std::vector<Level> pyramid_;        // pyramid_[k] is level k + 1
+    std::vector<FixedAxis> down_cols_;  // DownSample into pyramid_[k]
+    std::vector<FixedAxis> down_rows_;
+    std::vector<FixedAxis> up_cols_;    // Upsample into level k (pyramid_[k - 1], the output for 0)
+    std::vector<FixedAxis> up_rows_;
+    uint16_t* fixed_rows_;              // threads_ rows of width_ * channels_
+    std::vector<uint32_t> scratch_;     // threads_ pairs of vertical sum rows
+    std::vector<float> float_rows_;     // threads_ rows for ConvertRowToRGBA8
+    size_t row_size_;                   // width_ * channels_
+    size_t fixed_stride_;
+    bool level_timing_ = false;
+    std::vector<double> level_ms_;
+};
+
+inline FixedBloomContext::FixedBloomContext(int width, int height, int channels, int levels)
+    : width_(width), height_(height), channels_(channels), levels_(levels),
+      threads_(omp_get_max_threads()), row_size_((size_t)width * channels), fixed_stride_(0) {
+    ArenaLayout arena(64 / sizeof(uint16_t));
+    arena.AddLevels(width, height, channels, levels);
+    fixed_stride_ = arena.RoundUp(row_size_);
+    const size_t rows_offset = arena.Add(threads_ * fixed_stride_);
+
+    arena_ = ImageBuffer<uint16_t>(arena.total);
+    scratch_.assign(threads_ * 2 * row_size_, 0);
+    float_rows_.assign(threads_ * row_size_, 0.0f);
+    fixed_rows_ = arena_.Get() + rows_offset;
+
+    int src_w = width;
+    int src_h = height;
+    for (const ArenaLayout::Level& level : arena.levels) {
+        pyramid_.push_back({level.width, level.height, arena_.Get() + level.offset});
+        down_cols_.emplace_back(level.width, src_w, channels, 0.5, 5);
+        down_rows_.emplace_back(level.height, src_h, 1, 0.5, 5);
+        up_cols_.emplace_back(src_w, level.width, channels, 0.0, 3);
+        up_rows_.emplace_back(src_h, level.height, 1, 0.0, 3);
+        src_w = level.width;
+        src_h = level.height;
+    }
+
+    // Zero-filled, so every page is touched here and not during the first frame. Each row
+    // by the thread the static schedules in BloomToRGBA8() give it, which on NUMA hosts puts
+    // the page on that thread's node (with OMP_PROC_BIND keeping the threads in place).
+    #pragma omp parallel num_threads(threads_)
+    {
+        for (const Level& level : pyramid_) {
+            const ptrdiff_t row = (ptrdiff_t)level.width * channels;
+            #pragma omp for schedule(static) nowait
+            for (int i = 0; i < level.height; ++i) {
+                std::fill(level.data + i * row, level.data + (i + 1) * row, uint16_t(0));
+            }
+        }
+        uint16_t* fixed_row = fixed_rows_ + omp_get_thread_num() * fixed_stride_;
+        std::fill(fixed_row, fixed_row + fixed_stride_, uint16_t(0));
+    }
+}
+
+inline void FixedBloomContext::BloomToRGBA8(const unsigned char* src, Color* out, const BloomOutput& output) {
+    BLOOM_TRACE_SCOPE("FixedBloomToRGBA8", TraceArgs{.width = width_, .height = height_, .channels = channels_});
+    const int c = channels_;
+
+    DispatchChannels(c, false, [&](auto channels, auto) {
+        constexpr int C = decltype(channels)::value;
+
+        // Thread-local scratch of the row loops below
+        auto scratch = [&](uint32_t*& first, uint32_t*& second) {
+            first = scratch_.data() + omp_get_thread_num() * 2 * row_size_;
+            second = first + row_size_;
+        };
+
+        // Adds the time since the last call to `level`, see SetLevelTiming()
+        auto lap_start = std::chrono::steady_clock::now();
+        auto lap = [&](int level) {
+            if (level_timing_) {
+                const auto now = std::chrono::steady_clock::now();
+                level_ms_[level] += std::chrono::duration<double, std::milli>(now - lap_start).count();
+                lap_start = now;
+            }
+        };
+        if (level_timing_) {
+            level_ms_.assign(levels_ + 1, 0.0);
+        }
+
+        // Down the pyramid, level 1 straight from the bytes
+        for (int k = 0; k < levels_; ++k) {
+            Level& dst = pyramid_[k];
+            const int src_w = k == 0 ? width_ : pyramid_[k - 1].width;
+            BLOOM_TRACE_SCOPE("Fixed DownSample",
+                              TraceArgs{.level = k + 1, .width = dst.width, .height = dst.height, .channels = c,
+                                        .bytes = (size_t)dst.width * dst.height * c * 5 * sizeof(uint16_t)});
+
+            #pragma omp parallel num_threads(threads_) if(dst.height > 32)
+            {
+                uint32_t* inner;
+                uint32_t* outer;
+                scratch(inner, outer);
+
+                #pragma omp for schedule(static)
+                for (int i = 0; i < dst.height; ++i) {
+                    uint16_t* dst_row = dst.data + (ptrdiff_t)i * dst.width * c;
+                    if (k == 0) {
+                        FixedDownSampleRow<C>(src, src_w, c, 257, dst_row, dst.width, down_cols_[k], down_rows_[k],
+                                              i, inner, outer);
+                    } else {
+                        FixedDownSampleRow<C>(pyramid_[k - 1].data, src_w, c, 1, dst_row, dst.width, down_cols_[k],
+                                              down_rows_[k], i, inner, outer);
+                    }
+                }
+            }
+            lap(k + 1);
+        }
+
+        // Back up, every level blended in place with the one below
+        for (int k = levels_ - 1; k > 0; --k) {
+            Level& dst = pyramid_[k - 1];
+            const Level& below = pyramid_[k];
+            BLOOM_TRACE_SCOPE("Fixed UpsampleBlend",
+                              TraceArgs{.level = k, .width = dst.width, .height = dst.height, .channels = c,
+                                        .bytes = (size_t)dst.width * dst.height * c * 3 * sizeof(uint16_t)});
+
+            #pragma omp parallel num_threads(threads_) if(dst.height > 64)
+            {
+                uint32_t* vertical;
+                uint32_t* unused;
+                scratch(vertical, unused);
+
+                #pragma omp for schedule(static)
+                for (int i = 0; i < dst.height; ++i) {
+                    uint16_t* dst_row = dst.data + (ptrdiff_t)i * dst.width * c;
+                    FixedUpsampleBlendRow<C>(below.data, below.width, c, dst_row, 1, dst_row, dst.width,
+                                             up_cols_[k], up_rows_[k], i, vertical);
+                }
+            }
+            lap(k + 1);
+        }
+
+        // Final blend with the input and the output stage, one row at a time
+        BLOOM_TRACE_SCOPE("Fixed output rows", TraceArgs{.level = 0, .width = width_, .height = height_, .channels = c});
+        const float mult = (float)(output.mult / kFixedOne);
+        #pragma omp parallel num_threads(threads_) if(height_ > 64)
+        {
+            uint32_t* vertical;
+            uint32_t* unused;
+            scratch(vertical, unused);
+            uint16_t* fixed_row = fixed_rows_ + omp_get_thread_num() * fixed_stride_;
+            float* float_row = float_rows_.data() + omp_get_thread_num() * row_size_;
+
+            #pragma omp for schedule(static)
+            for (int i = 0; i < height_; ++i) {
+                const unsigned char* src_row = src + (ptrdiff_t)i * row_size_;
+                if (levels_ > 0) {
+                    FixedUpsampleBlendRow<C>(pyramid_[0].data, pyramid_[0].width, c, src_row, 257, fixed_row,
+                                             width_, up_cols_[0], up_rows_[0], i, vertical);
+                    std::copy(fixed_row, fixed_row + row_size_, float_row);
+                } else {
+                    for (size_t x = 0; x < row_size_; ++x) {
+                        float_row[x] = src_row[x] * 257.0f;
+                    }
+                }
+                ConvertRowToRGBA8(float_row, out + (ptrdiff_t)i * width_, width_, c, mult, output.tone_map);
+            }
+        }
+        lap(0);
+    });
+}
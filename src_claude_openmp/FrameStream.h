@@ -0,0 +1,201 @@
+#pragma once
+#include <Bloom.h>
+#include <atomic>
+#include <condition_variable>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Bloom for a stream of raw frames, e.g. between an ffmpeg decoder and encoder:
+//
+//   ffmpeg -i in.mp4 -f rawvideo -pix_fmt rgb24 - |
+//   Bloom_CPP --stream 1920 1080 3 |
+//   ffmpeg -f rawvideo -pix_fmt rgb24 -s 1920x1080 -r 30 -i - out.mp4
+//
+// Frames are headerless interleaved 8-bit samples, output frames have the same layout as
+// the input ones. Reading + unpacking, bloom and packing + writing run as three pipeline
+// stages on their own threads, connected by bounded queues, so the throughput is set by
+// the slowest stage instead of the sum of all three. Frame buffers are recycled through
+// the queues, nothing is allocated once the stream is running.
+
+// Fixed-capacity blocking FIFO, a ring buffer allocated once. Close() wakes up every
+// waiting thread: Push() then drops the item and Pop() returns false once the queue is empty.
+template <typename Item>
+class BoundedQueue {
+public:
+    explicit BoundedQueue(size_t capacity) : capacity_(capacity), items_(capacity) {}
+
+    bool Push(Item item) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        not_full_.wait(lock, [&] { return closed_ || count_ < capacity_; });
+        if (closed_) {
+            return false;
+        }
+        items_[(head_ + count_) % capacity_] = std::move(item);
+        ++count_;
+        not_empty_.notify_one();
+        return true;
+    }
+
+    bool Pop(Item& item) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        not_empty_.wait(lock, [&] { return closed_ || count_ > 0; });
+        if (count_ == 0) {
+            return false;
+        }
+        item = std::move(items_[head_]);
+        head_ = (head_ + 1) % capacity_;
+        --count_;
+        not_full_.notify_one();
+        return true;
+    }
+
+    void Close() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        closed_ = true;
+        not_empty_.notify_all();
+        not_full_.notify_all();
+    }
+
+private:
+    size_t capacity_;
+    std::vector<Item> items_;
+    size_t head_ = 0;          // Oldest item
+    size_t count_ = 0;
+    bool closed_ = false;
+    std::mutex mutex_;
+    std::condition_variable not_empty_;
+    std::condition_variable not_full_;
+};
+
+struct FrameStreamOptions {
+    int levels = 8;
+    int queue_depth = 2;       // Frames waiting between two stages
+    BloomOutput output;
+    BloomPrefilter prefilter;
+    BloomTemporal temporal;    // Coarse levels kept across frames, off by default
+};
+
+struct FrameStreamResult {
+    bool ok = false;
+    const char* error = nullptr;
+    long long frames = 0;
+    long long reused_levels = 0;   // Summed over the frames (see BloomTemporalStats)
+};
+
+// Packs one RGBA8 row into `channels` samples per pixel (gray = r, gray + alpha = r, a)
+inline void PackRGBA8Row(const Color* src, unsigned char* dst, int width, int channels) {
+    for (int x = 0; x < width; ++x) {
+        const Color& c = src[x];
+        unsigned char* d = dst + x * channels;
+        switch (channels) {
+            case 1: d[0] = c.r; break;
+            case 2: d[0] = c.r; d[1] = c.a; break;
+            case 3: d[0] = c.r; d[1] = c.g; d[2] = c.b; break;
+            default: d[0] = c.r; d[1] = c.g; d[2] = c.b; d[3] = c.a; break;
+        }
+    }
+}
+
+// Blooms every frame of `input` into `output` until the end of the input. A trailing
+// partial frame is an error.
+template <typename T = float>
+FrameStreamResult StreamBloom(FILE* input, FILE* output, int width, int height, int channels,
+                              const FrameStreamOptions& options = {}) {
+    FrameStreamResult result;
+    const size_t frame_bytes = (size_t)width * height * channels;
+    const size_t pixels = (size_t)width * height;
+
+    // Every buffer is either being worked on by one stage or waiting in one queue
+    size_t pool_size = options.queue_depth + 2;
+    std::vector<std::unique_ptr<MyImage<T>>> frames;
+    std::vector<std::vector<Color>> colors;
+    BoundedQueue<MyImage<T>*> free_frames(pool_size);
+    BoundedQueue<MyImage<T>*> decoded(options.queue_depth);
+    BoundedQueue<Color*> free_colors(pool_size);
+    BoundedQueue<Color*> bloomed(options.queue_depth);
+    for (size_t k = 0; k < pool_size; ++k) {
+        frames.push_back(std::make_unique<MyImage<T>>(width, height, channels, ImageInit::Uninitialized));
+        colors.emplace_back(pixels);
+        free_frames.Push(frames.back().get());
+        free_colors.Push(colors.back().data());
+    }
+
+    BloomContext<T> context(width, height, channels, options.levels, {}, options.prefilter);
+    context.SetTemporal(options.temporal);
+    std::atomic<bool> read_error(false);
+    std::atomic<bool> write_error(false);
+
+    // Stage 1: read and unpack to normalized samples
+    std::thread reader([&] {
+        std::vector<unsigned char> bytes(frame_bytes);
+        const T inv255 = T(1) / T(255);
+        MyImage<T>* frame = nullptr;
+        while (!write_error && free_frames.Pop(frame)) {
+            size_t n = 0;
+            {
+                BLOOM_TRACE_SCOPE("ReadFrame", TraceArgs{.width = width, .height = height, .channels = channels,
+                                                         .bytes = frame_bytes * (1 + sizeof(T))});
+                n = std::fread(bytes.data(), 1, frame_bytes, input);
+                T* data = frame->GetRawData();
+                for (size_t k = 0; k < n; ++k) {
+                    data[k] = bytes[k] * inv255;
+                }
+            }
+            if (n != frame_bytes) {
+                read_error = n != 0 || std::ferror(input);
+                break;
+            }
+            decoded.Push(frame);
+        }
+        decoded.Close();
+    });
+
+    // Stage 3: pack and write
+    std::thread writer([&] {
+        std::vector<unsigned char> bytes(frame_bytes);
+        Color* frame = nullptr;
+        while (bloomed.Pop(frame)) {
+            if (!write_error) {
+                BLOOM_TRACE_SCOPE("WriteFrame", TraceArgs{.width = width, .height = height, .channels = channels,
+                                                          .bytes = pixels * sizeof(Color) + frame_bytes});
+                for (int y = 0; y < height; ++y) {
+                    PackRGBA8Row(frame + (size_t)y * width, bytes.data() + (size_t)y * width * channels,
+                                 width, channels);
+                }
+                write_error = std::fwrite(bytes.data(), 1, frame_bytes, output) != frame_bytes;
+            }
+            free_colors.Push(frame);
+        }
+        write_error = write_error || std::fflush(output) != 0;
+    });
+
+    // Stage 2: bloom, on this thread so it keeps the OpenMP thread pool
+    MyImage<T>* frame = nullptr;
+    Color* out = nullptr;
+    while (decoded.Pop(frame)) {
+        free_colors.Pop(out);
+        context.BloomToRGBA8(*frame, out, options.output);
+        result.reused_levels += context.GetTemporalStats().reused_levels;
+        free_frames.Push(frame);
+        bloomed.Push(out);
+        ++result.frames;
+    }
+    bloomed.Close();
+
+    // The reader may still be waiting for a free frame if the writer failed
+    free_frames.Close();
+    reader.join();
+    writer.join();
+
+    if (read_error) {
+        result.error = "read error or truncated frame";
+    } else if (write_error) {
+        result.error = "write error";
+    } else {
+        result.ok = true;
+    }
+    return result;
+}
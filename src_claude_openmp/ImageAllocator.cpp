@@ -0,0 +1,200 @@
+#include <ImageAllocator.h>
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <string>
+
+#if defined(__linux__)
+#include <sys/mman.h>
+#endif
+
+void* AlignedImageAllocator::Allocate(size_t bytes) {
+    return ::operator new(std::max(bytes, size_t(1)), std::align_val_t(kImageAlignment));
+}
+
+void AlignedImageAllocator::Deallocate(void* data, size_t) {
+    ::operator delete(data, std::align_val_t(kImageAlignment));
+}
+
+#if defined(__linux__)
+
+namespace {
+
+size_t RoundUpToHugePages(size_t bytes) {
+    const size_t page = HugePageImageAllocator::kHugePageBytes;
+    return (bytes + page - 1) / page * page;
+}
+
+// Anonymous mapping of `bytes` (a multiple of the huge page size) starting on a huge page
+// boundary: mapped with one extra page of slack, the misaligned ends unmapped again
+void* MapAligned(size_t bytes) {
+    const size_t page = HugePageImageAllocator::kHugePageBytes;
+    void* mapped = mmap(nullptr, bytes + page, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mapped == MAP_FAILED) {
+        return nullptr;
+    }
+    char* begin = static_cast<char*>(mapped);
+    char* aligned = begin + (page - (size_t)begin % page) % page;
+    if (aligned > begin) {
+        munmap(begin, aligned - begin);
+    }
+    char* end = begin + bytes + page;
+    if (end > aligned + bytes) {
+        munmap(aligned + bytes, end - (aligned + bytes));
+    }
+    return aligned;
+}
+
+}  // namespace
+
+void* HugePageImageAllocator::Allocate(size_t bytes) {
+    if (bytes < kHugePageBytes) {
+        return small_.Allocate(bytes);
+    }
+    const size_t mapped = RoundUpToHugePages(bytes);
+    if (explicit_pages_) {
+        void* data = mmap(nullptr, mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (data != MAP_FAILED) {
+            return data;
+        }
+    }
+    void* data = MapAligned(mapped);
+    if (!data) {
+        throw std::bad_alloc();
+    }
+#if defined(MADV_HUGEPAGE)
+    // Only a hint, THP may be disabled or the range may end up in 4 KiB pages anyway
+    madvise(data, mapped, MADV_HUGEPAGE);
+#endif
+    return data;
+}
+
+void HugePageImageAllocator::Deallocate(void* data, size_t bytes) {
+    if (bytes < kHugePageBytes) {
+        small_.Deallocate(data, bytes);
+        return;
+    }
+    // Both kinds of mapping go away the same way
+    munmap(data, RoundUpToHugePages(bytes));
+}
+
+#else
+
+void* HugePageImageAllocator::Allocate(size_t bytes) {
+    return small_.Allocate(bytes);
+}
+
+void HugePageImageAllocator::Deallocate(void* data, size_t bytes) {
+    small_.Deallocate(data, bytes);
+}
+
+#endif
+
+PoolImageAllocator::PoolImageAllocator(ImageAllocator& upstream, size_t max_cached_bytes)
+    : upstream_(upstream), max_cached_bytes_(max_cached_bytes), name_(std::string(upstream.GetName()) + ",pool") {
+}
+
+PoolImageAllocator::~PoolImageAllocator() {
+    Trim();
+}
+
+size_t PoolImageAllocator::GetSizeClass(size_t bytes) {
+    if (bytes <= kMinClass) {
+        return kMinClass;
+    }
+    const size_t step = std::bit_floor(bytes - 1) / 4;
+    return (bytes + step - 1) / step * step;
+}
+
+void* PoolImageAllocator::Allocate(size_t bytes) {
+    const size_t size = GetSizeClass(bytes);
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = free_.find(size);
+        if (it != free_.end() && !it->second.empty()) {
+            void* data = it->second.back();
+            it->second.pop_back();
+            cached_bytes_ -= size;
+            ++hits_;
+            return data;
+        }
+        ++misses_;
+    }
+    return upstream_.Allocate(size);
+}
+
+void PoolImageAllocator::Deallocate(void* data, size_t bytes) {
+    const size_t size = GetSizeClass(bytes);
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (cached_bytes_ + size <= max_cached_bytes_) {
+            free_[size].push_back(data);
+            cached_bytes_ += size;
+            return;
+        }
+    }
+    upstream_.Deallocate(data, size);
+}
+
+void PoolImageAllocator::Trim() {
+    std::unordered_map<size_t, std::vector<void*>> buffers;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        buffers.swap(free_);
+        cached_bytes_ = 0;
+    }
+    for (auto& [size, list] : buffers) {
+        for (void* data : list) {
+            upstream_.Deallocate(data, size);
+        }
+    }
+}
+
+namespace {
+
+// From BLOOM_ALLOC, see ImageAllocator.h. Never destroyed, images in other static objects
+// may still be freed during exit.
+ImageAllocator& GetEnvironmentAllocator() {
+    static ImageAllocator* allocator = [] {
+        const char* env = std::getenv("BLOOM_ALLOC");
+        const std::string list = env ? env : "";
+        auto has = [&](const char* name) {
+            size_t begin = 0;
+            while (begin <= list.size()) {
+                size_t end = std::min(list.find(',', begin), list.size());
+                if (list.compare(begin, end - begin, name) == 0) {
+                    return true;
+                }
+                begin = end + 1;
+            }
+            return false;
+        };
+
+        ImageAllocator* base;
+        if (has("hugetlb")) {
+            base = new HugePageImageAllocator(true);
+        } else if (has("thp")) {
+            base = new HugePageImageAllocator(false);
+        } else {
+            base = new AlignedImageAllocator();
+        }
+        return has("pool") ? static_cast<ImageAllocator*>(new PoolImageAllocator(*base)) : base;
+    }();
+    return *allocator;
+}
+
+std::atomic<ImageAllocator*> g_default_allocator{nullptr};
+
+}  // namespace
+
+ImageAllocator& GetDefaultImageAllocator() {
+    ImageAllocator* allocator = g_default_allocator.load(std::memory_order_acquire);
+    return allocator ? *allocator : GetEnvironmentAllocator();
+}
+
+void SetDefaultImageAllocator(ImageAllocator* allocator) {
+    g_default_allocator.store(allocator, std::memory_order_release);
+}
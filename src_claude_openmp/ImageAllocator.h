@@ -0,0 +1,160 @@
+#pragma once
+#include <cstddef>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// Where MyImage samples and BloomContext arenas come from.
+//
+// Every allocator returns memory aligned to at least kImageAlignment bytes, so SIMD rows
+// starting at a level's first sample can use aligned loads. Memory is handed out
+// uninitialized: what needs zeros asks for them (see ImageInit), and untouched pages keep
+// their NUMA placement open for the first-touch passes.
+//
+// The default allocator comes from BLOOM_ALLOC on first use, a comma-separated list of
+//   aligned   64-byte aligned operator new (the default)
+//   thp       large buffers mmapped on 2 MiB boundaries and marked for transparent huge pages
+//   hugetlb   large buffers from the explicit huge page pool (vm.nr_hugepages), else as thp
+//   pool      on top of any of the above: freed buffers are kept by size class and reused
+// e.g. BLOOM_ALLOC=thp,pool. SetDefaultImageAllocator() overrides it.
+
+constexpr size_t kImageAlignment = 64;
+
+// How a new MyImage buffer starts out
+enum class ImageInit {
+    Zero,           // All samples 0
+    Uninitialized,  // For kernel outputs that write every sample anyway
+};
+
+class ImageAllocator {
+public:
+    virtual ~ImageAllocator() = default;
+
+    // At least kImageAlignment-aligned, never nullptr (throws std::bad_alloc)
+    virtual void* Allocate(size_t bytes) = 0;
+    // `bytes` as passed to the Allocate() that returned `data`
+    virtual void Deallocate(void* data, size_t bytes) = 0;
+    virtual const char* GetName() const = 0;
+};
+
+// operator new with kImageAlignment, works everywhere
+class AlignedImageAllocator : public ImageAllocator {
+public:
+    void* Allocate(size_t bytes) override;
+    void Deallocate(void* data, size_t bytes) override;
+    const char* GetName() const override { return "aligned"; }
+};
+
+// Buffers of at least kHugePageBytes are mapped in whole huge pages, which saves most of the
+// TLB misses of walking 4K/8K frames row by row. Smaller ones, and every buffer outside
+// Linux, come from the aligned allocator.
+class HugePageImageAllocator : public ImageAllocator {
+public:
+    static constexpr size_t kHugePageBytes = size_t(2) << 20;
+
+    // `explicit_pages`: MAP_HUGETLB first, transparent huge pages if the pool is empty
+    explicit HugePageImageAllocator(bool explicit_pages = false) : explicit_pages_(explicit_pages) {}
+
+    void* Allocate(size_t bytes) override;
+    void Deallocate(void* data, size_t bytes) override;
+    const char* GetName() const override { return explicit_pages_ ? "hugetlb" : "thp"; }
+
+private:
+    bool explicit_pages_;
+    AlignedImageAllocator small_;
+};
+
+// Keeps freed buffers in free lists by size class and hands them out again, so the levels
+// of repeated one-shot Bloom() calls or DownSample/Upsample chains stop going back to the
+// system (and the kernel stops zeroing fresh pages for them). Classes are powers of two
+// split in quarters, so a buffer is at most 25% larger than asked for. At most
+// `max_cached_bytes` are kept, anything freed beyond that goes back upstream. Thread safe.
+// A recycled buffer keeps the NUMA placement of its first use.
+class PoolImageAllocator : public ImageAllocator {
+public:
+    explicit PoolImageAllocator(ImageAllocator& upstream, size_t max_cached_bytes = size_t(1) << 30);
+    ~PoolImageAllocator() override;
+
+    void* Allocate(size_t bytes) override;
+    void Deallocate(void* data, size_t bytes) override;
+    const char* GetName() const override { return name_.c_str(); }
+
+    // Returns every cached buffer to the upstream allocator
+    void Trim();
+
+    inline size_t GetCachedBytes() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return cached_bytes_;
+    }
+    // Allocations served from the free lists / passed upstream
+    inline std::pair<size_t, size_t> GetHitsAndMisses() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return {hits_, misses_};
+    }
+
+    // Bytes actually allocated for a request of `bytes`
+    static size_t GetSizeClass(size_t bytes);
+
+private:
+    static constexpr size_t kMinClass = 4096;
+
+    ImageAllocator& upstream_;
+    size_t max_cached_bytes_;
+    std::string name_;
+    mutable std::mutex mutex_;
+    std::unordered_map<size_t, std::vector<void*>> free_;   // Size class -> buffers
+    size_t cached_bytes_ = 0;
+    size_t hits_ = 0;
+    size_t misses_ = 0;
+};
+
+// Used by MyImage and the engines when no allocator is given
+ImageAllocator& GetDefaultImageAllocator();
+// nullptr goes back to the BLOOM_ALLOC one. Only affects buffers allocated afterwards; the
+// allocator has to outlive every buffer it hands out.
+void SetDefaultImageAllocator(ImageAllocator* allocator);
+
+// Owning array of `size` T from an ImageAllocator, for buffers that aren't a MyImage
+// (e.g. BloomContext arenas). Uninitialized, like the allocators.
+template <typename T>
+class ImageBuffer {
+public:
+    ImageBuffer() = default;
+    explicit ImageBuffer(size_t size, ImageAllocator* allocator = nullptr)
+        : allocator_(allocator ? allocator : &GetDefaultImageAllocator()), size_(size) {
+        data_ = size > 0 ? static_cast<T*>(allocator_->Allocate(size * sizeof(T))) : nullptr;
+    }
+    ~ImageBuffer() { Release_(); }
+
+    ImageBuffer(const ImageBuffer&) = delete;
+    ImageBuffer& operator=(const ImageBuffer&) = delete;
+    ImageBuffer(ImageBuffer&& other) noexcept
+        : allocator_(other.allocator_), data_(std::exchange(other.data_, nullptr)),
+          size_(std::exchange(other.size_, 0)) {}
+    ImageBuffer& operator=(ImageBuffer&& other) noexcept {
+        if (this != &other) {
+            Release_();
+            allocator_ = other.allocator_;
+            data_ = std::exchange(other.data_, nullptr);
+            size_ = std::exchange(other.size_, 0);
+        }
+        return *this;
+    }
+
+    inline T* Get() const { return data_; }
+    inline size_t GetSize() const { return size_; }
+
+private:
+    ImageAllocator* allocator_ = nullptr;
+    T* data_ = nullptr;
+    size_t size_ = 0;
+
+    void Release_() {
+        if (data_) {
+            allocator_->Deallocate(data_, size_ * sizeof(T));
+        }
+        data_ = nullptr;
+    }
+};
@@ -0,0 +1,766 @@
+#include <ImageCodecs.h>
+#include <Trace.h>
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define BLOOM_HAVE_MMAP 1
+#endif
+
+namespace {
+
+// Extension of `path` including the dot, "" without one
+const char* Extension(const char* path) {
+    const char* dot = std::strrchr(path, '.');
+    return dot && !std::strchr(dot, '/') && !std::strchr(dot, '\\') ? dot : "";
+}
+
+// Header tokenizer for PNM and PFM: whitespace separated fields, `#` comments to the end
+// of the line
+struct HeaderReader {
+    const unsigned char* data;
+    size_t size;
+    size_t pos = 0;
+
+    void SkipSpace() {
+        while (pos < size) {
+            if (data[pos] == '#') {
+                while (pos < size && data[pos] != '\n') ++pos;
+            } else if (std::isspace(data[pos])) {
+                ++pos;
+            } else {
+                break;
+            }
+        }
+    }
+
+    bool ReadInt(int& value) {
+        SkipSpace();
+        long long v = 0;
+        size_t start = pos;
+        while (pos < size && data[pos] >= '0' && data[pos] <= '9' && v < (1ll << 31)) {
+            v = v * 10 + (data[pos++] - '0');
+        }
+        value = (int)v;
+        return pos > start && v < (1ll << 31);
+    }
+
+    bool ReadFloat(double& value) {
+        SkipSpace();
+        char text[64];
+        size_t n = 0;
+        while (pos < size && n + 1 < sizeof(text) && !std::isspace(data[pos])) {
+            text[n++] = (char)data[pos++];
+        }
+        text[n] = '\0';
+        char* end = nullptr;
+        value = std::strtod(text, &end);
+        return n > 0 && end == text + n;
+    }
+
+    // The single whitespace byte between the header and the samples
+    bool EndHeader() {
+        if (pos >= size || !std::isspace(data[pos])) {
+            return false;
+        }
+        ++pos;
+        return true;
+    }
+};
+
+bool WriteFile(const char* filename, const void* header, size_t header_size, const void* data, size_t size) {
+    FILE* file = std::fopen(filename, "wb");
+    if (!file) {
+        return false;
+    }
+    bool ok = std::fwrite(header, 1, header_size, file) == header_size &&
+              std::fwrite(data, 1, size, file) == size;
+    return std::fclose(file) == 0 && ok;
+}
+
+// QOI (https://qoiformat.org/qoi-specification.pdf)
+constexpr unsigned char kQoiOpIndex = 0x00;
+constexpr unsigned char kQoiOpDiff = 0x40;
+constexpr unsigned char kQoiOpLuma = 0x80;
+constexpr unsigned char kQoiOpRun = 0xc0;
+constexpr unsigned char kQoiOpRgb = 0xfe;
+constexpr unsigned char kQoiOpRgba = 0xff;
+constexpr unsigned char kQoiEnd[8] = {0, 0, 0, 0, 0, 0, 0, 1};
+
+inline int QoiHash(const Color& c) {
+    return (c.r * 3 + c.g * 5 + c.b * 7 + c.a * 11) % 64;
+}
+
+inline bool SameColor(const Color& a, const Color& b) {
+    return a.r == b.r && a.g == b.g && a.b == b.b && a.a == b.a;
+}
+
+void PutBigEndian32(unsigned char* p, uint32_t v) {
+    p[0] = (unsigned char)(v >> 24);
+    p[1] = (unsigned char)(v >> 16);
+    p[2] = (unsigned char)(v >> 8);
+    p[3] = (unsigned char)v;
+}
+
+bool IsOpaque(const Color* colors, size_t count) {
+    for (size_t k = 0; k < count; ++k) {
+        if (colors[k].a != 255) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// PNG: zlib stream with fixed-Huffman deflate, see RFC 1950/1951
+struct Crc32Table {
+    uint32_t table[256];
+
+    Crc32Table() {
+        for (uint32_t n = 0; n < 256; ++n) {
+            uint32_t c = n;
+            for (int k = 0; k < 8; ++k) {
+                c = c & 1 ? 0xedb88320u ^ (c >> 1) : c >> 1;
+            }
+            table[n] = c;
+        }
+    }
+};
+
+uint32_t Crc32(const unsigned char* data, size_t size, uint32_t crc = 0) {
+    static const Crc32Table crc_table;
+    crc = ~crc;
+    for (size_t k = 0; k < size; ++k) {
+        crc = crc_table.table[(crc ^ data[k]) & 0xff] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+uint32_t Adler32(const unsigned char* data, size_t size) {
+    uint32_t a = 1;
+    uint32_t b = 0;
+    while (size > 0) {
+        // Largest block whose sums can't overflow before the modulo
+        size_t n = std::min<size_t>(size, 5552);
+        for (size_t k = 0; k < n; ++k) {
+            a += data[k];
+            b += a;
+        }
+        a %= 65521;
+        b %= 65521;
+        data += n;
+        size -= n;
+    }
+    return b << 16 | a;
+}
+
+class BitWriter {
+public:
+    explicit BitWriter(std::vector<unsigned char>& out) : out_(out) {}
+
+    // `count` bits of `value`, least significant first
+    void Put(uint32_t value, int count) {
+        bits_ |= (uint64_t)value << count_;
+        count_ += count;
+        while (count_ >= 8) {
+            out_.push_back((unsigned char)bits_);
+            bits_ >>= 8;
+            count_ -= 8;
+        }
+    }
+
+    // Huffman codes go most significant bit first
+    void PutCode(uint32_t code, int length) {
+        uint32_t reversed = 0;
+        for (int k = 0; k < length; ++k) {
+            reversed |= ((code >> k) & 1) << (length - 1 - k);
+        }
+        Put(reversed, length);
+    }
+
+    void Flush() {
+        if (count_ > 0) {
+            out_.push_back((unsigned char)bits_);
+        }
+        bits_ = 0;
+        count_ = 0;
+    }
+
+private:
+    std::vector<unsigned char>& out_;
+    uint64_t bits_ = 0;
+    int count_ = 0;
+};
+
+constexpr int kLengthBase[29] = {3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+                                 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+constexpr int kLengthExtra[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+                                  3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+constexpr int kDistanceBase[30] = {1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385,
+                                   513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577};
+constexpr int kDistanceExtra[30] = {0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7,
+                                    8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+constexpr int kWindow = 32768;
+constexpr int kMaxMatch = 258;
+
+// Fixed literal/length code of `symbol` (0-287)
+void PutFixedSymbol(BitWriter& bits, int symbol) {
+    if (symbol < 144) bits.PutCode(0x30 + symbol, 8);
+    else if (symbol < 256) bits.PutCode(0x190 + symbol - 144, 9);
+    else if (symbol < 280) bits.PutCode(symbol - 256, 7);
+    else bits.PutCode(0xc0 + symbol - 280, 8);
+}
+
+void PutMatch(BitWriter& bits, int length, int distance) {
+    int l = 28;
+    while (kLengthBase[l] > length) --l;
+    PutFixedSymbol(bits, 257 + l);
+    bits.Put(length - kLengthBase[l], kLengthExtra[l]);
+
+    int d = 29;
+    while (kDistanceBase[d] > distance) --d;
+    bits.PutCode(d, 5);
+    bits.Put(distance - kDistanceBase[d], kDistanceExtra[d]);
+}
+
+// Deflate stream of `data`: stored blocks for level 0, one fixed-Huffman block with
+// hash chain matching otherwise, the chains searched deeper at higher levels
+void Deflate(const unsigned char* data, size_t size, int level, std::vector<unsigned char>& out) {
+    if (level == 0) {
+        size_t pos = 0;
+        do {
+            size_t n = std::min<size_t>(size - pos, 65535);
+            bool last = pos + n == size;
+            out.push_back(last ? 1 : 0);
+            out.push_back((unsigned char)n);
+            out.push_back((unsigned char)(n >> 8));
+            out.push_back((unsigned char)~n);
+            out.push_back((unsigned char)(~n >> 8));
+            out.insert(out.end(), data + pos, data + pos + n);
+            pos += n;
+        } while (pos < size);
+        return;
+    }
+
+    const int max_chain = 1 << (level - 1);
+    const int good_length = level < 4 ? 8 : 32;     // Long enough to stop searching
+    constexpr int kHashBits = 15;
+    std::vector<int64_t> head(1 << kHashBits, -1);
+    std::vector<int64_t> prev(kWindow, -1);
+    auto hash = [&](size_t p) {
+        return ((uint32_t)data[p] << 16 ^ (uint32_t)data[p + 1] << 8 ^ data[p + 2]) * 2654435761u >> (32 - kHashBits);
+    };
+    auto insert = [&](size_t p) {
+        if (p + 3 <= size) {
+            uint32_t h = hash(p);
+            prev[p % kWindow] = head[h];
+            head[h] = (int64_t)p;
+        }
+    };
+
+    BitWriter bits(out);
+    bits.Put(1, 1);       // Final block
+    bits.Put(1, 2);       // Fixed Huffman codes
+    size_t pos = 0;
+    while (pos < size) {
+        int best_length = 0;
+        int best_distance = 0;
+        if (pos + 3 <= size) {
+            const int limit = (int)std::min<size_t>(kMaxMatch, size - pos);
+            int64_t candidate = head[hash(pos)];
+            for (int chain = 0; chain < max_chain && candidate >= 0 && (int64_t)pos - candidate <= kWindow;
+                 ++chain) {
+                const unsigned char* a = data + candidate;
+                const unsigned char* b = data + pos;
+                if (a[best_length] == b[best_length]) {
+                    int length = 0;
+                    while (length < limit && a[length] == b[length]) ++length;
+                    if (length > best_length) {
+                        best_length = length;
+                        best_distance = (int)(pos - candidate);
+                        if (length >= good_length || length == limit) break;
+                    }
+                }
+                int64_t next = prev[candidate % kWindow];
+                if (next >= candidate) break;   // Slot reused by a newer position
+                candidate = next;
+            }
+        }
+
+        if (best_length >= 3) {
+            PutMatch(bits, best_length, best_distance);
+            for (int k = 0; k < best_length; ++k) {
+                insert(pos + k);
+            }
+            pos += best_length;
+        } else {
+            PutFixedSymbol(bits, data[pos]);
+            insert(pos);
+            ++pos;
+        }
+    }
+    PutFixedSymbol(bits, 256);
+    bits.Flush();
+}
+
+inline int Paeth(int a, int b, int c) {
+    int p = a + b - c;
+    int pa = std::abs(p - a);
+    int pb = std::abs(p - b);
+    int pc = std::abs(p - c);
+    return pa <= pb && pa <= pc ? a : (pb <= pc ? b : c);
+}
+
+// Applies PNG filter `type` to `row` (above: the previous raw row, zeros for the first)
+void FilterRow(int type, const unsigned char* row, const unsigned char* above, size_t bytes, int bpp,
+               unsigned char* dst) {
+    for (size_t k = 0; k < bytes; ++k) {
+        int left = k >= (size_t)bpp ? row[k - bpp] : 0;
+        int up = above[k];
+        int up_left = k >= (size_t)bpp ? above[k - bpp] : 0;
+        int predicted = 0;
+        switch (type) {
+            case 1: predicted = left; break;
+            case 2: predicted = up; break;
+            case 3: predicted = (left + up) / 2; break;
+            case 4: predicted = Paeth(left, up, up_left); break;
+            default: break;
+        }
+        dst[k] = (unsigned char)(row[k] - predicted);
+    }
+}
+
+void PutChunk(std::vector<unsigned char>& png, const char* type, const unsigned char* data, size_t size) {
+    unsigned char header[8];
+    PutBigEndian32(header, (uint32_t)size);
+    std::memcpy(header + 4, type, 4);
+    png.insert(png.end(), header, header + 8);
+    png.insert(png.end(), data, data + size);
+    unsigned char crc[4];
+    PutBigEndian32(crc, Crc32(data, size, Crc32(header + 4, 4)));
+    png.insert(png.end(), crc, crc + 4);
+}
+
+}  // namespace
+
+bool HasExtension(const char* path, const char* extension) {
+    const char* ext = Extension(path);
+    size_t n = std::strlen(extension);
+    if (std::strlen(ext) != n) {
+        return false;
+    }
+    for (size_t k = 0; k < n; ++k) {
+        if (std::tolower((unsigned char)ext[k]) != extension[k]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+MappedFile::MappedFile(const char* path) {
+#if defined(BLOOM_HAVE_MMAP)
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return;
+    }
+    struct stat info;
+    if (fstat(fd, &info) == 0 && info.st_size > 0) {
+        void* p = mmap(nullptr, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p != MAP_FAILED) {
+            // Conversion walks the file in parallel, ask for all of it at once
+            madvise(p, (size_t)info.st_size, MADV_WILLNEED);
+            data_ = static_cast<const unsigned char*>(p);
+            size_ = (size_t)info.st_size;
+            mapped_ = true;
+        }
+    }
+    close(fd);
+#else
+    FILE* file = std::fopen(path, "rb");
+    if (!file) {
+        return;
+    }
+    std::fseek(file, 0, SEEK_END);
+    long size = std::ftell(file);
+    std::fseek(file, 0, SEEK_SET);
+    if (size > 0) {
+        buffer_.resize((size_t)size);
+        if (std::fread(buffer_.data(), 1, buffer_.size(), file) == buffer_.size()) {
+            data_ = buffer_.data();
+            size_ = buffer_.size();
+        }
+    }
+    std::fclose(file);
+#endif
+}
+
+MappedFile::~MappedFile() {
+#if defined(BLOOM_HAVE_MMAP)
+    if (mapped_) {
+        munmap(const_cast<unsigned char*>(data_), size_);
+    }
+#endif
+}
+
+bool IsBuiltinImageFormat(const char* path) {
+    return HasExtension(path, ".ppm") || HasExtension(path, ".pgm") || HasExtension(path, ".pnm") ||
+           HasExtension(path, ".pfm") || HasExtension(path, ".qoi");
+}
+
+ImageFile::ImageFile(const char* path) : file_(path) {
+    BLOOM_TRACE_SCOPE("ImageFile::Open");
+    if (!file_.IsOpen()) {
+        error_ = "can't open the file";
+    } else if (HasExtension(path, ".pfm")) {
+        OpenPfm_();
+    } else if (HasExtension(path, ".qoi")) {
+        OpenQoi_();
+    } else {
+        OpenPnm_();
+    }
+    if (error_) {
+        width = height = channels = 0;
+    }
+}
+
+void ImageFile::OpenPnm_() {
+    HeaderReader header{file_.GetData(), file_.GetSize()};
+    if (header.size < 2 || header.data[0] != 'P' || (header.data[1] != '5' && header.data[1] != '6')) {
+        error_ = "not a binary PGM/PPM (P5/P6) file";
+        return;
+    }
+    channels = header.data[1] == '5' ? 1 : 3;
+    header.pos = 2;
+    if (!header.ReadInt(width) || !header.ReadInt(height) || !header.ReadInt(max_value_) ||
+        !header.EndHeader() || width <= 0 || height <= 0 || max_value_ <= 0 || max_value_ > 65535) {
+        error_ = "bad PNM header";
+        return;
+    }
+    sample_ = max_value_ < 256 ? Sample::U8 : Sample::U16BE;
+    row_bytes_ = (size_t)width * channels * (sample_ == Sample::U8 ? 1 : 2);
+    // Divided, not multiplied: the header sizes can overflow the byte count
+    if ((size_t)height > (file_.GetSize() - header.pos) / row_bytes_) {
+        error_ = "truncated PNM file";
+        return;
+    }
+    data_ = file_.GetData() + header.pos;
+}
+
+void ImageFile::OpenPfm_() {
+    HeaderReader header{file_.GetData(), file_.GetSize()};
+    if (header.size < 2 || header.data[0] != 'P' || (header.data[1] != 'F' && header.data[1] != 'f')) {
+        error_ = "not a PFM file";
+        return;
+    }
+    channels = header.data[1] == 'f' ? 1 : 3;
+    header.pos = 2;
+    double scale = 0.0;
+    if (!header.ReadInt(width) || !header.ReadInt(height) || !header.ReadFloat(scale) ||
+        !header.EndHeader() || width <= 0 || height <= 0 || scale == 0.0) {
+        error_ = "bad PFM header";
+        return;
+    }
+    sample_ = Sample::F32;
+    big_endian_ = scale > 0.0;
+    flip_ = true;
+    row_bytes_ = (size_t)width * channels * 4;
+    // Divided, not multiplied: the header sizes can overflow the byte count
+    if ((size_t)height > (file_.GetSize() - header.pos) / row_bytes_) {
+        error_ = "truncated PFM file";
+        return;
+    }
+    data_ = file_.GetData() + header.pos;
+}
+
+void ImageFile::OpenQoi_() {
+    const unsigned char* p = file_.GetData();
+    const size_t size = file_.GetSize();
+    if (size < 14 + sizeof(kQoiEnd) || std::memcmp(p, "qoif", 4) != 0) {
+        error_ = "not a QOI file";
+        return;
+    }
+    uint32_t w = (uint32_t)p[4] << 24 | p[5] << 16 | p[6] << 8 | p[7];
+    uint32_t h = (uint32_t)p[8] << 24 | p[9] << 16 | p[10] << 8 | p[11];
+    channels = p[12];
+    if (w == 0 || h == 0 || w > 0x7fffffff || h > 0x7fffffff || (channels != 3 && channels != 4)) {
+        error_ = "bad QOI header";
+        return;
+    }
+    // Every op byte encodes at most 62 pixels (a run), so a header claiming more than the
+    // payload can hold is rejected before decoded_ is allocated for it
+    const size_t max_pixels = (size - sizeof(kQoiEnd) - 14) * 62;
+    if ((size_t)w > max_pixels / h) {
+        error_ = "bad QOI header";
+        return;
+    }
+    width = (int)w;
+    height = (int)h;
+
+    BLOOM_TRACE_SCOPE("QOI decode", TraceArgs{.width = width, .height = height, .channels = channels,
+                                              .bytes = size + (size_t)width * height * channels});
+    const size_t pixels = (size_t)width * height;
+    decoded_.resize(pixels * channels);
+    Color index[64] = {};
+    Color px = {0, 0, 0, 255};
+    size_t pos = 14;
+    const size_t end = size - sizeof(kQoiEnd);
+    int run = 0;
+    unsigned char* dst = decoded_.data();
+    for (size_t k = 0; k < pixels; ++k) {
+        if (run > 0) {
+            --run;
+        } else if (pos < end) {
+            unsigned char op = p[pos++];
+            if (op == kQoiOpRgb) {
+                if (pos + 3 > end) break;
+                px.r = p[pos];
+                px.g = p[pos + 1];
+                px.b = p[pos + 2];
+                pos += 3;
+            } else if (op == kQoiOpRgba) {
+                if (pos + 4 > end) break;
+                px = {p[pos], p[pos + 1], p[pos + 2], p[pos + 3]};
+                pos += 4;
+            } else if ((op & 0xc0) == kQoiOpIndex) {
+                px = index[op];
+            } else if ((op & 0xc0) == kQoiOpDiff) {
+                px.r += ((op >> 4) & 3) - 2;
+                px.g += ((op >> 2) & 3) - 2;
+                px.b += (op & 3) - 2;
+            } else if ((op & 0xc0) == kQoiOpLuma) {
+                if (pos + 1 > end) break;
+                int dg = (op & 0x3f) - 32;
+                int b2 = p[pos++];
+                px.r += dg - 8 + ((b2 >> 4) & 0x0f);
+                px.g += dg;
+                px.b += dg - 8 + (b2 & 0x0f);
+            } else {
+                run = op & 0x3f;
+            }
+            index[QoiHash(px)] = px;
+        } else {
+            error_ = "truncated QOI file";
+            return;
+        }
+
+        dst[0] = px.r;
+        dst[1] = px.g;
+        dst[2] = px.b;
+        if (channels == 4) {
+            dst[3] = px.a;
+        }
+        dst += channels;
+    }
+    if (dst != decoded_.data() + decoded_.size()) {
+        error_ = "truncated QOI file";
+        return;
+    }
+    data_ = decoded_.data();
+    row_bytes_ = (size_t)width * channels;
+}
+
+bool WritePnm(const Color* colors, int width, int height, bool gray, const char* filename) {
+    BLOOM_TRACE_SCOPE("WritePnm", TraceArgs{.width = width, .height = height, .channels = gray ? 1 : 3});
+    const int channels = gray ? 1 : 3;
+    std::vector<unsigned char> samples((size_t)width * height * channels);
+    const ptrdiff_t pixels = (ptrdiff_t)width * height;
+    #pragma omp parallel for schedule(static) if(pixels > 50000)
+    for (ptrdiff_t k = 0; k < pixels; ++k) {
+        unsigned char* d = samples.data() + k * channels;
+        d[0] = colors[k].r;
+        if (!gray) {
+            d[1] = colors[k].g;
+            d[2] = colors[k].b;
+        }
+    }
+    char header[64];
+    int n = std::snprintf(header, sizeof(header), "P%c\n%d %d\n255\n", gray ? '5' : '6', width, height);
+    return WriteFile(filename, header, n, samples.data(), samples.size());
+}
+
+bool WritePfm(const float* samples, int width, int height, int channels, const char* filename) {
+    BLOOM_TRACE_SCOPE("WritePfm", TraceArgs{.width = width, .height = height, .channels = channels});
+    if (channels != 1 && channels != 3) {
+        return false;
+    }
+    // Little endian (negative scale), rows bottom to top
+    const size_t row = (size_t)width * channels;
+    std::vector<unsigned char> data(row * height * 4);
+    #pragma omp parallel for schedule(static) if(height > 64)
+    for (int y = 0; y < height; ++y) {
+        const float* src = samples + (size_t)(height - 1 - y) * row;
+        unsigned char* dst = data.data() + (size_t)y * row * 4;
+        for (size_t k = 0; k < row; ++k) {
+            uint32_t bits;
+            std::memcpy(&bits, src + k, sizeof(bits));
+            dst[4 * k] = (unsigned char)bits;
+            dst[4 * k + 1] = (unsigned char)(bits >> 8);
+            dst[4 * k + 2] = (unsigned char)(bits >> 16);
+            dst[4 * k + 3] = (unsigned char)(bits >> 24);
+        }
+    }
+    char header[64];
+    int n = std::snprintf(header, sizeof(header), "P%c\n%d %d\n-1.0\n", channels == 1 ? 'f' : 'F', width, height);
+    return WriteFile(filename, header, n, data.data(), data.size());
+}
+
+bool WritePfmRGBA8(const Color* colors, int width, int height, const char* filename) {
+    std::vector<float> samples((size_t)width * height * 3);
+    const ptrdiff_t pixels = (ptrdiff_t)width * height;
+    #pragma omp parallel for schedule(static) if(pixels > 50000)
+    for (ptrdiff_t k = 0; k < pixels; ++k) {
+        samples[k * 3] = colors[k].r / 255.0f;
+        samples[k * 3 + 1] = colors[k].g / 255.0f;
+        samples[k * 3 + 2] = colors[k].b / 255.0f;
+    }
+    return WritePfm(samples.data(), width, height, 3, filename);
+}
+
+bool WriteQoi(const Color* colors, int width, int height, const char* filename) {
+    BLOOM_TRACE_SCOPE("WriteQoi", TraceArgs{.width = width, .height = height, .channels = 4});
+    const size_t pixels = (size_t)width * height;
+    const int channels = IsOpaque(colors, pixels) ? 3 : 4;
+
+    unsigned char header[14];
+    std::memcpy(header, "qoif", 4);
+    PutBigEndian32(header + 4, (uint32_t)width);
+    PutBigEndian32(header + 8, (uint32_t)height);
+    header[12] = (unsigned char)channels;
+    header[13] = 0;     // sRGB with linear alpha
+
+    // Worst case is one RGBA op per pixel
+    std::vector<unsigned char> out;
+    out.reserve(pixels * (channels + 1) + sizeof(kQoiEnd));
+    Color index[64] = {};
+    Color previous = {0, 0, 0, 255};
+    int run = 0;
+    for (size_t k = 0; k < pixels; ++k) {
+        const Color px = colors[k];
+        if (SameColor(px, previous)) {
+            if (++run == 62) {
+                out.push_back(kQoiOpRun | (run - 1));
+                run = 0;
+            }
+            continue;
+        }
+        if (run > 0) {
+            out.push_back(kQoiOpRun | (run - 1));
+            run = 0;
+        }
+
+        const int h = QoiHash(px);
+        if (SameColor(index[h], px)) {
+            out.push_back(kQoiOpIndex | h);
+        } else {
+            index[h] = px;
+            if (px.a == previous.a) {
+                signed char dr = (signed char)(px.r - previous.r);
+                signed char dg = (signed char)(px.g - previous.g);
+                signed char db = (signed char)(px.b - previous.b);
+                signed char dr_dg = (signed char)(dr - dg);
+                signed char db_dg = (signed char)(db - dg);
+                if (dr > -3 && dr < 2 && dg > -3 && dg < 2 && db > -3 && db < 2) {
+                    out.push_back(kQoiOpDiff | (dr + 2) << 4 | (dg + 2) << 2 | (db + 2));
+                } else if (dr_dg > -9 && dr_dg < 8 && dg > -33 && dg < 32 && db_dg > -9 && db_dg < 8) {
+                    out.push_back(kQoiOpLuma | (dg + 32));
+                    out.push_back((unsigned char)((dr_dg + 8) << 4 | (db_dg + 8)));
+                } else {
+                    out.insert(out.end(), {kQoiOpRgb, px.r, px.g, px.b});
+                }
+            } else {
+                out.insert(out.end(), {kQoiOpRgba, px.r, px.g, px.b, px.a});
+            }
+        }
+        previous = px;
+    }
+    if (run > 0) {
+        out.push_back(kQoiOpRun | (run - 1));
+    }
+    out.insert(out.end(), kQoiEnd, kQoiEnd + sizeof(kQoiEnd));
+    return WriteFile(filename, header, sizeof(header), out.data(), out.size());
+}
+
+bool WritePng(const Color* colors, int width, int height, int level, const char* filename) {
+    BLOOM_TRACE_SCOPE("WritePng", TraceArgs{.width = width, .height = height, .channels = 4});
+    level = std::max(0, std::min(level, 9));
+    const size_t pixels = (size_t)width * height;
+    const int bpp = IsOpaque(colors, pixels) ? 3 : 4;
+    const size_t row_bytes = (size_t)width * bpp;
+
+    // Filtered rows, each behind its filter type byte: none when storing, Sub for the fast
+    // levels, the one with the smallest sum of absolute residuals above that
+    std::vector<unsigned char> filtered((row_bytes + 1) * height);
+    #pragma omp parallel if(height > 64)
+    {
+        std::vector<unsigned char> row(row_bytes);
+        std::vector<unsigned char> above(row_bytes, 0);
+        std::vector<unsigned char> candidate(row_bytes);
+
+        #pragma omp for schedule(static)
+        for (int y = 0; y < height; ++y) {
+            auto pack = [&](int yy, unsigned char* dst) {
+                const Color* src = colors + (size_t)yy * width;
+                for (int x = 0; x < width; ++x) {
+                    dst[x * bpp] = src[x].r;
+                    dst[x * bpp + 1] = src[x].g;
+                    dst[x * bpp + 2] = src[x].b;
+                    if (bpp == 4) dst[x * bpp + 3] = src[x].a;
+                }
+            };
+            pack(y, row.data());
+            if (y > 0) {
+                pack(y - 1, above.data());
+            } else {
+                std::fill(above.begin(), above.end(), 0);
+            }
+
+            unsigned char* dst = filtered.data() + (size_t)y * (row_bytes + 1);
+            int type = level == 0 ? 0 : 1;
+            if (level >= 4) {
+                long best = -1;
+                for (int t = 0; t < 5; ++t) {
+                    FilterRow(t, row.data(), above.data(), row_bytes, bpp, candidate.data());
+                    long sum = 0;
+                    for (size_t k = 0; k < row_bytes; ++k) {
+                        sum += std::abs((int)(signed char)candidate[k]);
+                    }
+                    if (best < 0 || sum < best) {
+                        best = sum;
+                        type = t;
+                    }
+                }
+            }
+            dst[0] = (unsigned char)type;
+            FilterRow(type, row.data(), above.data(), row_bytes, bpp, dst + 1);
+        }
+    }
+
+    std::vector<unsigned char> zlib = {0x78, (unsigned char)(level == 0 ? 0x01 : level < 6 ? 0x5e : 0x9c)};
+    {
+        BLOOM_TRACE_SCOPE("Deflate", TraceArgs{.bytes = filtered.size()});
+        Deflate(filtered.data(), filtered.size(), level, zlib);
+    }
+    unsigned char adler[4];
+    PutBigEndian32(adler, Adler32(filtered.data(), filtered.size()));
+    zlib.insert(zlib.end(), adler, adler + 4);
+
+    std::vector<unsigned char> png = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+    unsigned char ihdr[13];
+    PutBigEndian32(ihdr, (uint32_t)width);
+    PutBigEndian32(ihdr + 4, (uint32_t)height);
+    ihdr[8] = 8;                        // Bits per sample
+    ihdr[9] = bpp == 4 ? 6 : 2;         // RGBA or RGB
+    ihdr[10] = ihdr[11] = ihdr[12] = 0; // Deflate, adaptive filters, no interlace
+    PutChunk(png, "IHDR", ihdr, sizeof(ihdr));
+    for (size_t pos = 0; pos < zlib.size(); pos += 1 << 30) {
+        PutChunk(png, "IDAT", zlib.data() + pos, std::min<size_t>(zlib.size() - pos, 1 << 30));
+    }
+    PutChunk(png, "IEND", nullptr, 0);
+    return WriteFile(filename, png.data(), png.size(), nullptr, 0);
+}
@@ -0,0 +1,127 @@
+#pragma once
+#include <raylib.h>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+// Built-in codecs for the formats where raylib's PNG inflate/deflate would cost more than
+// the bloom itself:
+//   .ppm / .pgm   binary PNM (P6 / P5), 8 or 16 bits per sample
+//   .pfm          float PFM (PF / Pf), samples are read and written unnormalized
+//   .qoi          QOI, lossless and fast to compress
+//   .png          writing only, with a selectable deflate effort (SaveOptions)
+// Inputs are memory mapped where the platform allows it, so PNM and PFM samples are
+// converted straight from the page cache. Everything else goes through raylib.
+
+// Read-only view of a whole file: mmap on POSIX systems, a heap copy elsewhere
+class MappedFile {
+public:
+    explicit MappedFile(const char* path);
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    inline bool IsOpen() const { return data_ != nullptr; }
+    inline const unsigned char* GetData() const { return data_; }
+    inline size_t GetSize() const { return size_; }
+
+private:
+    const unsigned char* data_ = nullptr;
+    size_t size_ = 0;
+    bool mapped_ = false;
+    std::vector<unsigned char> buffer_;   // Without mmap
+};
+
+// Case-insensitive check of the extension of `path`, e.g. HasExtension(path, ".ppm")
+bool HasExtension(const char* path, const char* extension);
+
+// True for the extensions ImageFile reads
+bool IsBuiltinImageFormat(const char* path);
+
+// A decoded or mapped .ppm, .pgm, .pfm or .qoi image, converted one row at a time
+class ImageFile {
+public:
+    explicit ImageFile(const char* path);
+
+    ImageFile(const ImageFile&) = delete;
+    ImageFile& operator=(const ImageFile&) = delete;
+
+    inline bool IsOpen() const { return error_ == nullptr; }
+    inline const char* GetError() const { return error_; }
+
+    int width = 0;
+    int height = 0;
+    int channels = 0;
+
+    // Row y (top to bottom) as width * channels samples: 8 and 16-bit ones divided by the
+    // PNM maxval (255 for QOI), float ones as stored
+    template <typename T>
+    void ReadRow(int y, T* dst) const {
+        const unsigned char* src = data_ + (flip_ ? height - 1 - y : y) * row_bytes_;
+        const size_t n = (size_t)width * channels;
+        switch (sample_) {
+            case Sample::U8: {
+                const T scale = T(1) / T(max_value_);
+                for (size_t k = 0; k < n; ++k) {
+                    dst[k] = src[k] * scale;
+                }
+                break;
+            }
+            case Sample::U16BE: {
+                const T scale = T(1) / T(max_value_);
+                for (size_t k = 0; k < n; ++k) {
+                    dst[k] = (src[2 * k] << 8 | src[2 * k + 1]) * scale;
+                }
+                break;
+            }
+            case Sample::F32: {
+                for (size_t k = 0; k < n; ++k) {
+                    const unsigned char* b = src + 4 * k;
+                    uint32_t bits = big_endian_ ? (uint32_t)b[0] << 24 | b[1] << 16 | b[2] << 8 | b[3]
+                                                : (uint32_t)b[3] << 24 | b[2] << 16 | b[1] << 8 | b[0];
+                    float value;
+                    std::memcpy(&value, &bits, sizeof(value));
+                    dst[k] = T(value);
+                }
+                break;
+            }
+        }
+    }
+
+private:
+    enum class Sample { U8, U16BE, F32 };
+
+    MappedFile file_;
+    std::vector<unsigned char> decoded_;    // QOI pixels
+    const char* error_ = nullptr;
+    const unsigned char* data_ = nullptr;   // Row 0 as stored
+    size_t row_bytes_ = 0;
+    Sample sample_ = Sample::U8;
+    int max_value_ = 255;
+    bool big_endian_ = false;
+    bool flip_ = false;                     // PFM rows are stored bottom to top
+
+    void OpenPnm_();
+    void OpenPfm_();
+    void OpenQoi_();
+};
+
+// Options of SaveRGBA8() and MyImage::Save()
+struct SaveOptions {
+    // PNG deflate effort: 0 stores the pixels uncompressed, 1-9 trade speed for size with
+    // the built-in encoder, -1 keeps raylib's (slowest, smallest files)
+    int png_level = -1;
+};
+
+// Writers for RGBA8 pixels. .ppm drops alpha, .pgm keeps the red channel, .pfm stores
+// samples / 255. Return false if the file can't be written.
+bool WritePnm(const Color* colors, int width, int height, bool gray, const char* filename);
+bool WritePfmRGBA8(const Color* colors, int width, int height, const char* filename);
+bool WriteQoi(const Color* colors, int width, int height, const char* filename);
+bool WritePng(const Color* colors, int width, int height, int level, const char* filename);
+
+// Float PFM from interleaved samples, 1 (Pf) or 3 (PF) channels, stored top to bottom in
+// `samples` (the writer flips them)
+bool WritePfm(const float* samples, int width, int height, int channels, const char* filename);
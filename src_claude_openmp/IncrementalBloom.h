@@ -0,0 +1,339 @@
+#pragma once
+#include <Bloom.h>
+#include <ImageAllocator.h>
+#include <MyImage.h>
+#include <Trace.h>
+#include <assert.h>
+#include <algorithm>
+#include <vector>
+#include <omp.h>
+
+// Bloom of frames where only a rectangle of the input changed since the previous one, e.g.
+// a UI compositor redrawing one widget.
+//
+// The context keeps both pyramids of the previous frame: every level as downsampled, and
+// every level after its blend with the upsampled level below. A changed input rectangle is
+// mapped through the tap extents of each pass: the 13-tap DownSample to the level 1..n
+// pixels whose taps read it, then the 9-tap Upsample back up to the blended level and
+// output pixels whose taps read a changed one. Only those rectangles are recomputed, with
+// the same row kernels as BloomContext, so the output is identical to a full recompute.
+// The cost follows the changed area plus the spread of the kernels, which the coarse levels
+// widen to roughly 2^levels output pixels around the change: that part of the output does
+// change.
+//
+// A context tracks one output: use either Bloom() or BloomToRGBA8() with it, not both.
+
+// Pixel rectangle [x0, x1) x [y0, y1)
+struct PixelRect {
+    int x0 = 0;
+    int y0 = 0;
+    int x1 = 0;
+    int y1 = 0;
+
+    inline bool IsEmpty() const { return x1 <= x0 || y1 <= y0; }
+    inline size_t GetArea() const { return IsEmpty() ? 0 : (size_t)(x1 - x0) * (y1 - y0); }
+
+    // Bounding box of both
+    inline PixelRect Union(const PixelRect& other) const {
+        if (IsEmpty()) return other;
+        if (other.IsEmpty()) return *this;
+        return {std::min(x0, other.x0), std::min(y0, other.y0), std::max(x1, other.x1), std::max(y1, other.y1)};
+    }
+
+    inline PixelRect Clip(int width, int height) const {
+        return {std::max(x0, 0), std::max(y0, 0), std::min(x1, width), std::min(y1, height)};
+    }
+};
+
+// For one axis of a resampling pass: the source positions each output position reads. Both
+// ends only grow with the position, so the outputs reading a source span are found by
+// binary search.
+struct FootprintAxis {
+    std::vector<int> src_begin;   // [pos]
+    std::vector<int> src_end;
+
+    // DownSampleRow along an axis of new_size from src_size, with DownSampleSourceRows' margin
+    template <typename T>
+    static FootprintAxis DownSample(int new_size, int src_size) {
+        FootprintAxis axis;
+        const DownSampleAxis<T> taps(new_size, src_size, 1);
+        for (int pos = 0; pos < new_size; ++pos) {
+            int begin, end;
+            DownSampleSourceRows(taps, src_size, pos, pos + 1, begin, end);
+            axis.src_begin.push_back(begin);
+            axis.src_end.push_back(end);
+        }
+        return axis;
+    }
+
+    // UpsampleRow along an axis of new_size from src_size
+    static FootprintAxis Upsample(int new_size, int src_size) {
+        FootprintAxis axis;
+        for (int pos = 0; pos < new_size; ++pos) {
+            int begin, end;
+            UpsampleSourceRows(src_size, new_size, pos, pos + 1, begin, end);
+            axis.src_begin.push_back(begin);
+            axis.src_end.push_back(end);
+        }
+        return axis;
+    }
+
+    // Output positions reading any of source positions [begin, end)
+    inline void Targets(int begin, int end, int& out_begin, int& out_end) const {
+        out_begin = (int)(std::partition_point(src_end.begin(), src_end.end(), [&](int e) { return e <= begin; }) -
+                          src_end.begin());
+        out_end = (int)(std::partition_point(src_begin.begin(), src_begin.end(), [&](int b) { return b < end; }) -
+                        src_begin.begin());
+    }
+};
+
+template <typename T = float>
+class IncrementalBloomContext {
+public:
+    IncrementalBloomContext(int width, int height, int channels, int levels = 8);
+
+    // Levels are views into arena_
+    IncrementalBloomContext(const IncrementalBloomContext&) = delete;
+    IncrementalBloomContext& operator=(const IncrementalBloomContext&) = delete;
+    IncrementalBloomContext(IncrementalBloomContext&&) = default;
+    IncrementalBloomContext& operator=(IncrementalBloomContext&&) = default;
+
+    // Writes what BloomContext::Bloom() would leave in `image` to `result`, for an `image`
+    // that differs from the previous call's only inside `dirty`. Only the part of `result`
+    // that changes is written, the rest has to still hold the previous result. The first
+    // call (and the first after Invalidate()) computes everything. Returns the rectangle of
+    // `result` that was rewritten.
+    PixelRect Bloom(const MyImage<T>& image, MyImage<T>& result, const PixelRect& dirty);
+
+    // Same for BloomContext::BloomToRGBA8(), `out` holds width * height pixels. `output` has
+    // to stay the same between calls, otherwise Invalidate() first.
+    PixelRect BloomToRGBA8(const MyImage<T>& image, Color* out, const PixelRect& dirty,
+                           const BloomOutput& output = {});
+
+    // The next call recomputes everything
+    inline void Invalidate() { valid_ = false; }
+
+    inline int GetWidth() const { return width_; }
+    inline int GetHeight() const { return height_; }
+    inline int GetChannels() const { return channels_; }
+    inline int GetLevels() const { return levels_; }
+    inline size_t GetArenaBytes() const { return arena_.GetSize() * sizeof(T); }
+
+    // Pixels recomputed by the last call, over every level and the output
+    inline size_t GetUpdatedPixels() const { return updated_pixels_; }
+
+private:
+    // Rows of a region below this many pixels stay on the calling thread
+    static constexpr size_t kParallelPixels = 16384;
+
+    int width_;
+    int height_;
+    int channels_;
+    int levels_;
+    int threads_;                            // omp_get_max_threads() at construction
+    bool valid_ = false;
+    size_t updated_pixels_ = 0;
+
+    ImageBuffer<T> arena_;
+    std::vector<MyImage<T>> down_;           // down_[k] is level k + 1 as downsampled
+    std::vector<MyImage<T>> blended_;        // blended_[k] is level k + 1 after its blend (k < levels - 1)
+    std::vector<DownSampleAxis<T>> cols_;    // DownSample tap tables for down_[k]
+    std::vector<DownSampleAxis<T>> rows_;
+    std::vector<FootprintAxis> down_x_;      // DownSample into down_[k]
+    std::vector<FootprintAxis> down_y_;
+    std::vector<FootprintAxis> up_x_;        // Upsample from level k + 1 into level k (0: the output)
+    std::vector<FootprintAxis> up_y_;
+    std::vector<T> scratch_;                 // threads_ rows for BloomToRGBA8
+
+    // Level k + 1 as the level above reads it when upsampling
+    inline const MyImage<T>& Final_(int k) const { return k == levels_ - 1 ? down_[k] : blended_[k]; }
+
+    // Recomputes every level for input rectangle `dirty` and returns the output rectangle
+    // that depends on it
+    PixelRect Update_(const MyImage<T>& image, PixelRect dirty);
+
+    // Columns of `rect` widened to whole SIMD blocks (see kTileWidthAlign), so every pixel is
+    // computed by the same code path as in a full row
+    static PixelRect AlignColumns_(const PixelRect& rect, int width);
+
+    // Runs row(i, col_begin, col_end, thread) over the rows of `rect`
+    template <typename Row>
+    void ForEachRow_(const PixelRect& rect, const Row& row);
+};
+
+template <typename T>
+IncrementalBloomContext<T>::IncrementalBloomContext(int width, int height, int channels, int levels)
+    : width_(width), height_(height), channels_(channels), levels_(levels), threads_(omp_get_max_threads()) {
+    // Both copies of a level on their own cache lines
+    ArenaLayout arena(64 / sizeof(T));
+    arena.AddLevels(width, height, channels, levels);
+    std::vector<size_t> blended_offsets;
+    for (int k = 0; k < levels - 1; ++k) {
+        blended_offsets.push_back(arena.Add(arena.levels[k].size));
+    }
+    arena_ = ImageBuffer<T>(arena.total);
+
+    int src_w = width;
+    int src_h = height;
+    for (int k = 0; k < levels; ++k) {
+        const int new_w = arena.levels[k].width;
+        const int new_h = arena.levels[k].height;
+        down_.emplace_back(new_w, new_h, channels, arena_.Get() + arena.levels[k].offset);
+        if (k < levels - 1) {
+            blended_.emplace_back(new_w, new_h, channels, arena_.Get() + blended_offsets[k]);
+        }
+        cols_.emplace_back(new_w, src_w, channels);
+        rows_.emplace_back(new_h, src_h, 1);
+        down_x_.push_back(FootprintAxis::DownSample<T>(new_w, src_w));
+        down_y_.push_back(FootprintAxis::DownSample<T>(new_h, src_h));
+        up_x_.push_back(FootprintAxis::Upsample(src_w, new_w));
+        up_y_.push_back(FootprintAxis::Upsample(src_h, new_h));
+        src_w = new_w;
+        src_h = new_h;
+    }
+    scratch_.assign((size_t)threads_ * width * channels, T(0));
+}
+
+template <typename T>
+PixelRect IncrementalBloomContext<T>::AlignColumns_(const PixelRect& rect, int width) {
+    PixelRect aligned = rect;
+    aligned.x0 = rect.x0 / kTileWidthAlign * kTileWidthAlign;
+    aligned.x1 = std::min(width, (rect.x1 + kTileWidthAlign - 1) / kTileWidthAlign * kTileWidthAlign);
+    return aligned;
+}
+
+template <typename T>
+template <typename Row>
+void IncrementalBloomContext<T>::ForEachRow_(const PixelRect& rect, const Row& row) {
+    if (rect.IsEmpty()) {
+        return;
+    }
+    updated_pixels_ += rect.GetArea();
+    #pragma omp parallel for num_threads(threads_) schedule(static) if(rect.GetArea() > kParallelPixels)
+    for (int i = rect.y0; i < rect.y1; ++i) {
+        row(i, rect.x0, rect.x1, omp_get_thread_num());
+    }
+}
+
+template <typename T>
+PixelRect IncrementalBloomContext<T>::Update_(const MyImage<T>& image, PixelRect dirty) {
+    assert(image.width == width_ && image.height == height_ && image.channels == channels_);
+    if (!valid_) {
+        dirty = {0, 0, width_, height_};
+        valid_ = true;
+    }
+    dirty = dirty.Clip(width_, height_);
+    updated_pixels_ = 0;
+    if (dirty.IsEmpty()) {
+        return dirty;
+    }
+
+    // Changed pixels of every level: as downsampled, then after the blend
+    std::vector<PixelRect> down_dirty(levels_);
+    std::vector<PixelRect> final_dirty(levels_);
+    PixelRect above = dirty;
+    for (int k = 0; k < levels_ && !above.IsEmpty(); ++k) {
+        PixelRect& rect = down_dirty[k];
+        down_x_[k].Targets(above.x0, above.x1, rect.x0, rect.x1);
+        down_y_[k].Targets(above.y0, above.y1, rect.y0, rect.y1);
+        above = rect;
+    }
+    PixelRect below;
+    for (int k = levels_ - 1; k >= 0; --k) {
+        PixelRect upsampled;
+        if (k < levels_ - 1 && !below.IsEmpty()) {
+            up_x_[k + 1].Targets(below.x0, below.x1, upsampled.x0, upsampled.x1);
+            up_y_[k + 1].Targets(below.y0, below.y1, upsampled.y0, upsampled.y1);
+        }
+        final_dirty[k] = down_dirty[k].Union(upsampled);
+        below = final_dirty[k];
+    }
+    PixelRect output = dirty;
+    if (levels_ > 0 && !below.IsEmpty()) {
+        PixelRect upsampled;
+        up_x_[0].Targets(below.x0, below.x1, upsampled.x0, upsampled.x1);
+        up_y_[0].Targets(below.y0, below.y1, upsampled.y0, upsampled.y1);
+        output = output.Union(upsampled);
+    }
+
+    DispatchChannels(channels_, false, [&](auto channels, auto) {
+        constexpr int C = decltype(channels)::value;
+
+        // Down: only the pixels whose taps read a changed one
+        for (int k = 0; k < levels_; ++k) {
+            BLOOM_TRACE_SCOPE("Incremental DownSample", TraceArgs{.level = k + 1,
+                              .width = down_dirty[k].x1 - down_dirty[k].x0,
+                              .height = down_dirty[k].y1 - down_dirty[k].y0, .channels = channels_});
+            const MyImage<T>& src = k == 0 ? image : down_[k - 1];
+            ForEachRow_(AlignColumns_(down_dirty[k], down_[k].width), [&](int i, int col_begin, int col_end, int) {
+                DownSampleRow<C>(src, down_[k], cols_[k], rows_[k], i, col_begin, col_end);
+            });
+        }
+
+        // Up: the blend of every changed pixel, from its downsampled value again
+        for (int k = levels_ - 2; k >= 0; --k) {
+            BLOOM_TRACE_SCOPE("Incremental UpsampleBlend", TraceArgs{.level = k + 1,
+                              .width = final_dirty[k].x1 - final_dirty[k].x0,
+                              .height = final_dirty[k].y1 - final_dirty[k].y0, .channels = channels_});
+            MyImage<T>& dst = blended_[k];
+            ForEachRow_(AlignColumns_(final_dirty[k], dst.width), [&](int i, int col_begin, int col_end, int) {
+                const T* src_row = down_[k].GetRow(i);
+                T* row = dst.GetRow(i);
+                std::copy(src_row + col_begin * channels_, src_row + col_end * channels_, row + col_begin * channels_);
+                UpsampleRow<true, C>(Final_(k + 1), row, dst.width, dst.height, i, col_begin, col_end,
+                                     T(kBloomLerpWeight));
+            });
+        }
+    });
+    return AlignColumns_(output, width_);
+}
+
+template <typename T>
+PixelRect IncrementalBloomContext<T>::Bloom(const MyImage<T>& image, MyImage<T>& result, const PixelRect& dirty) {
+    BLOOM_TRACE_SCOPE("IncrementalBloom", TraceArgs{.width = width_, .height = height_, .channels = channels_});
+    assert(result.width == width_ && result.height == height_ && result.channels == channels_);
+    const PixelRect output = Update_(image, dirty);
+    constexpr T mult = T(kBloomMult);
+
+    // Final blend, multiplication and clamping, as in BloomContext::Bloom()
+    DispatchChannels(channels_, false, [&](auto channels, auto) {
+        constexpr int C = decltype(channels)::value;
+        ForEachRow_(output, [&](int i, int col_begin, int col_end, int) {
+            const T* src_row = image.GetRow(i);
+            T* row = result.GetRow(i);
+            std::copy(src_row + col_begin * channels_, src_row + col_end * channels_, row + col_begin * channels_);
+            if (levels_ > 0) {
+                UpsampleRow<true, C>(Final_(0), row, width_, height_, i, col_begin, col_end, T(kBloomLerpWeight));
+            }
+            for (int k = col_begin * channels_; k < col_end * channels_; ++k) {
+                row[k] = std::max(T(0), std::min(row[k] * mult, T(1)));
+            }
+        });
+    });
+    return output;
+}
+
+template <typename T>
+PixelRect IncrementalBloomContext<T>::BloomToRGBA8(const MyImage<T>& image, Color* out, const PixelRect& dirty,
+                                                   const BloomOutput& output) {
+    BLOOM_TRACE_SCOPE("IncrementalBloomToRGBA8", TraceArgs{.width = width_, .height = height_, .channels = channels_});
+    const PixelRect rect = Update_(image, dirty);
+    const int c = channels_;
+    const T mult = T(output.mult);
+
+    // The final blend in a scratch row per thread, converted right away
+    DispatchChannels(channels_, false, [&](auto channels, auto) {
+        constexpr int C = decltype(channels)::value;
+        ForEachRow_(rect, [&](int i, int col_begin, int col_end, int thread) {
+            T* row = scratch_.data() + (size_t)thread * width_ * c;
+            const T* src_row = image.GetRow(i);
+            std::copy(src_row + col_begin * c, src_row + col_end * c, row + col_begin * c);
+            if (levels_ > 0) {
+                UpsampleRow<true, C>(Final_(0), row, width_, height_, i, col_begin, col_end, T(kBloomLerpWeight));
+            }
+            ConvertRowToRGBA8(row + col_begin * c, out + (ptrdiff_t)i * width_ + col_begin, col_end - col_begin, c,
+                              mult, output.tone_map);
+        });
+    });
+    return rect;
+}
@@ -1,11 +1,43 @@
 #include <raylib.h>
 #include <MyImage.h>
+#include <Trace.h>
+#include <assert.h>
 #include <cstring>
 #include <cstdlib>
 #include <algorithm>
+#include <vector>
 
-MyImage::MyImage(const char* path) : path(path), data_(nullptr) {
-    image_ = LoadImage(path);
+template <typename T>
+MyImage<T>::MyImage(const char* path)
+    : path(path), image_{}, data_(nullptr), allocator_(&GetDefaultImageAllocator()) {
+    BLOOM_TRACE_SCOPE("MyImage::Load");
+    
+    // Built-in formats: converted straight from the mapped (or decoded) file, no raylib
+    // Image or Color copies in between
+    if (IsBuiltinImageFormat(path)) {
+        ImageFile file(path);
+        // Same channel and wording as raylib's own load failures, the image is then 0x0
+        if (!file.IsOpen()) {
+            TraceLog(LOG_WARNING, "IMAGE: [%s] Failed to load image: %s", path, file.GetError());
+        }
+        width = file.width;
+        height = file.height;
+        channels = file.channels;
+        AllocateData();
+        
+        BLOOM_TRACE_SCOPE("Load convert", TraceArgs{.width = width, .height = height, .channels = channels,
+                                                    .bytes = GetSize() * sizeof(T)});
+        #pragma omp parallel for schedule(static) if((size_t)width * height > 50000)
+        for (int y = 0; y < height; ++y) {
+            file.ReadRow(y, GetRow(y));
+        }
+        return;
+    }
+    
+    {
+        BLOOM_TRACE_SCOPE("LoadImage");
+        image_ = LoadImage(path);
+    }
     width = image_.width;
     height = image_.height;
     channels = GetChannelCount_(image_.format);
@@ -14,15 +46,17 @@ MyImage::MyImage(const char* path) : path(path), data_(nullptr) {
     
     // Load image data efficiently
     Color* colors = LoadImageColors(image_);
+    BLOOM_TRACE_SCOPE("Load convert", TraceArgs{.width = width, .height = height, .channels = channels,
+                                                .bytes = (size_t)width * height * sizeof(Color) + GetSize() * sizeof(T)});
     
     // Parallel memory layout conversion
-    const double inv255 = 1.0 / 255.0;
-    int total_pixels = width * height;
+    const T inv255 = T(1) / T(255);
+    ptrdiff_t total_pixels = (ptrdiff_t)width * height;
     
     #pragma omp parallel for schedule(static) if(total_pixels > 50000)
-    for (int pixel = 0; pixel < total_pixels; ++pixel) {
+    for (ptrdiff_t pixel = 0; pixel < total_pixels; ++pixel) {
         const Color& c = colors[pixel];
-        double* dst = data_ + pixel * channels;
+        T* dst = data_ + pixel * channels;
         
         dst[0] = c.r * inv255;
         dst[1] = c.g * inv255;
@@ -35,24 +69,36 @@ MyImage::MyImage(const char* path) : path(path), data_(nullptr) {
     UnloadImageColors(colors);
 }
 
-MyImage::MyImage(int width, int height, int channels) 
-    : width(width), height(height), channels(channels), path(nullptr), data_(nullptr) {
+template <typename T>
+MyImage<T>::MyImage(int width, int height, int channels, ImageInit init, ImageAllocator* allocator)
+    : width(width), height(height), channels(channels), path(nullptr), image_{}, data_(nullptr),
+      allocator_(allocator ? allocator : &GetDefaultImageAllocator()) {
     AllocateData();
-    // Initialize to zero
-    std::fill(data_, data_ + width * height * channels, 0.0);
+    if (init == ImageInit::Zero) {
+        CopyRows_(nullptr);
+    }
+}
+
+template <typename T>
+MyImage<T>::MyImage(int width, int height, int channels, T* data, int first_row)
+    : width(width), height(height), channels(channels), path(nullptr), image_{}, data_(data),
+      allocator_(nullptr), owns_data_(false), first_row_(first_row) {
 }
 
 // Copy constructor
-MyImage::MyImage(const MyImage& other) 
+template <typename T>
+MyImage<T>::MyImage(const MyImage& other) 
     : width(other.width), height(other.height), channels(other.channels), 
-      path(other.path), image_(other.image_), data_(nullptr) {
+      path(other.path), image_(other.image_), data_(nullptr),
+      allocator_(other.allocator_ ? other.allocator_ : &GetDefaultImageAllocator()) {
+    assert(other.first_row_ == 0);
     AllocateData();
-    int total_size = width * height * channels;
-    std::memcpy(data_, other.data_, total_size * sizeof(double));
+    CopyRows_(other.data_);
 }
 
 // Copy assignment
-MyImage& MyImage::operator=(const MyImage& other) {
+template <typename T>
+MyImage<T>& MyImage<T>::operator=(const MyImage& other) {
     if (this != &other) {
         DeallocateData();
         
@@ -61,24 +107,30 @@ MyImage& MyImage::operator=(const MyImage& other) {
         channels = other.channels;
         path = other.path;
         image_ = other.image_;
+        allocator_ = other.allocator_ ? other.allocator_ : &GetDefaultImageAllocator();
+        owns_data_ = true;
+        first_row_ = 0;
         
+        assert(other.first_row_ == 0);
         AllocateData();
-        int total_size = width * height * channels;
-        std::memcpy(data_, other.data_, total_size * sizeof(double));
+        CopyRows_(other.data_);
     }
     return *this;
 }
 
 // Move constructor
-MyImage::MyImage(MyImage&& other) noexcept
+template <typename T>
+MyImage<T>::MyImage(MyImage&& other) noexcept
     : width(other.width), height(other.height), channels(other.channels),
-      path(other.path), image_(other.image_), data_(other.data_) {
+      path(other.path), image_(other.image_), data_(other.data_), allocator_(other.allocator_),
+      owns_data_(other.owns_data_), first_row_(other.first_row_) {
     other.data_ = nullptr;
     other.width = other.height = other.channels = 0;
 }
 
 // Move assignment
-MyImage& MyImage::operator=(MyImage&& other) noexcept {
+template <typename T>
+MyImage<T>& MyImage<T>::operator=(MyImage&& other) noexcept {
     if (this != &other) {
         DeallocateData();
         
@@ -88,6 +140,9 @@ MyImage& MyImage::operator=(MyImage&& other) noexcept {
         path = other.path;
         image_ = other.image_;
         data_ = other.data_;
+        allocator_ = other.allocator_;
+        owns_data_ = other.owns_data_;
+        first_row_ = other.first_row_;
         
         other.data_ = nullptr;
         other.width = other.height = other.channels = 0;
@@ -95,54 +150,111 @@ MyImage& MyImage::operator=(MyImage&& other) noexcept {
     return *this;
 }
 
-MyImage::~MyImage() {
+template <typename T>
+MyImage<T>::~MyImage() {
     DeallocateData();
 }
 
-void MyImage::AllocateData() {
+template <typename T>
+void MyImage<T>::AllocateData() {
     if (width > 0 && height > 0 && channels > 0) {
-        data_ = new double[width * height * channels];
+        data_ = static_cast<T*>(allocator_->Allocate(GetSize() * sizeof(T)));
+    }
+}
+
+// A page lands on the NUMA node of the thread that first writes it, so the rows are
+// written in the same static row split as the kernels' loops instead of all by one thread
+template <typename T>
+void MyImage<T>::CopyRows_(const T* src) {
+    const size_t row = (size_t)width * channels;
+    #pragma omp parallel for schedule(static) if(GetSize() > 65536)
+    for (int y = 0; y < height; ++y) {
+        T* dst = data_ + y * row;
+        if (src) {
+            std::memcpy(dst, src + y * row, row * sizeof(T));
+        } else {
+            std::fill(dst, dst + row, T(0));
+        }
     }
 }
 
-void MyImage::DeallocateData() {
-    delete[] data_;
+template <typename T>
+void MyImage<T>::DeallocateData() {
+    if (owns_data_ && data_) {
+        allocator_->Deallocate(data_, GetSize() * sizeof(T));
+    }
     data_ = nullptr;
 }
 
-void MyImage::Save(const char* filename) {
-    Color* colors = new Color[width * height];
+template <typename T>
+bool MyImage<T>::Save(const char* filename, const SaveOptions& options) {
+    BLOOM_TRACE_SCOPE("MyImage::Save", TraceArgs{.width = width, .height = height, .channels = channels,
+                                                 .bytes = GetSize() * sizeof(T) + (size_t)width * height * sizeof(Color)});
     
-    int total_pixels = width * height;
+    // Float output keeps the samples as they are (gray or RGB, no alpha)
+    if (HasExtension(filename, ".pfm")) {
+        const int pfm_channels = channels >= 3 ? 3 : 1;
+        std::vector<float> samples((size_t)width * height * pfm_channels);
+        #pragma omp parallel for schedule(static) if(height > 64)
+        for (int y = 0; y < height; ++y) {
+            const T* src = GetRow(y);
+            float* dst = samples.data() + (size_t)y * width * pfm_channels;
+            for (int x = 0; x < width; ++x) {
+                for (int ch = 0; ch < pfm_channels; ++ch) {
+                    dst[x * pfm_channels + ch] = (float)src[x * channels + ch];
+                }
+            }
+        }
+        return WritePfm(samples.data(), width, height, pfm_channels, filename);
+    }
+    
+    Color* colors = new Color[(size_t)width * height];
     
-    // Parallel conversion from double to Color
+    ptrdiff_t total_pixels = (ptrdiff_t)width * height;
+    
+    // Parallel conversion from T to Color
     #pragma omp parallel for schedule(static) if(total_pixels > 50000)
-    for (int pixel = 0; pixel < total_pixels; ++pixel) {
-        const double* src = data_ + pixel * channels;
-        Color& c = colors[pixel];
-        
-        // Clamp and convert to byte values
-        c.r = (unsigned char)std::max(0.0, std::min(src[0] * 255.0, 255.0));
-        c.g = (unsigned char)std::max(0.0, std::min(src[1] * 255.0, 255.0));
-        c.b = (unsigned char)std::max(0.0, std::min(src[2] * 255.0, 255.0));
-        c.a = (channels == 4) 
-            ? (unsigned char)std::max(0.0, std::min(src[3] * 255.0, 255.0))
-            : 255;
+    for (int y = 0; y < height; ++y) {
+        ConvertRowToRGBA8(GetRow(y), colors + (ptrdiff_t)y * width, width, channels);
+    }
+    
+    bool ok = SaveRGBA8(colors, width, height, filename, options);
+    delete[] colors;
+    return ok;
+}
+
+bool SaveRGBA8(const Color* colors, int width, int height, const char* filename, const SaveOptions& options) {
+    BLOOM_TRACE_SCOPE("SaveRGBA8", TraceArgs{.width = width, .height = height, .channels = 4,
+                                             .bytes = (size_t)width * height * sizeof(Color)});
+    if (HasExtension(filename, ".ppm") || HasExtension(filename, ".pnm")) {
+        return WritePnm(colors, width, height, false, filename);
+    }
+    if (HasExtension(filename, ".pgm")) {
+        return WritePnm(colors, width, height, true, filename);
+    }
+    if (HasExtension(filename, ".pfm")) {
+        return WritePfmRGBA8(colors, width, height, filename);
+    }
+    if (HasExtension(filename, ".qoi")) {
+        return WriteQoi(colors, width, height, filename);
+    }
+    if (options.png_level >= 0 && HasExtension(filename, ".png")) {
+        return WritePng(colors, width, height, options.png_level, filename);
     }
     
     Image output = {
-        .data = colors,
+        .data = const_cast<Color*>(colors),
         .width = width,
         .height = height,
         .mipmaps = 1,
         .format = PIXELFORMAT_UNCOMPRESSED_R8G8B8A8
     };
     
-    ExportImage(output, filename);
-    delete[] colors;
+    return ExportImage(output, filename);
 }
 
-int MyImage::GetChannelCount_(int format) {
+template <typename T>
+int MyImage<T>::GetChannelCount_(int format) {
     switch (format) {
         case PIXELFORMAT_UNCOMPRESSED_GRAYSCALE:
             return 1;
@@ -155,4 +267,7 @@ int MyImage::GetChannelCount_(int format) {
         default:
             return 3;  // Default to RGB
     }
-}
\ No newline at end of file
+}
+
+template class MyImage<float>;
+template class MyImage<double>;
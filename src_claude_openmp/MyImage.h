@@ -1,48 +1,167 @@
 #pragma once
 #include <raylib.h>
+#include <ImageAllocator.h>
+#include <ImageCodecs.h>
+#include <algorithm>
+#include <cstddef>
 #include <vector>
 
+// Image with interleaved channels stored as normalized (0.0-1.0) samples of type T.
+// float is the production default (half the memory traffic of double),
+// double is kept around as the reference precision.
+// Sizes and offsets are computed in 64 bits so gigapixel images don't overflow.
+// Owned samples come from an ImageAllocator, kImageAlignment-aligned.
+template <typename T = float>
 class MyImage {
 public:
+    using value_type = T;
+
     int width;
     int height;
     int channels;
-    
-    // Constructors
+
+    // Constructors. .ppm/.pgm/.pfm/.qoi files are read by ImageCodecs, everything else by
+    // raylib. An image that can't be loaded is 0 x 0.
     MyImage(const char* path);
-    MyImage(int width, int height, int channels);
+    // `allocator` nullptr: GetDefaultImageAllocator()
+    MyImage(int width, int height, int channels, ImageInit init = ImageInit::Zero,
+            ImageAllocator* allocator = nullptr);
     
-    // Copy constructor and assignment operator for proper memory management
+    // Non-owning view over `data` (width * height * channels samples), e.g. a pyramid level
+    // inside a BloomContext arena. Copies of a view own their data.
+    // With first_row > 0 the view is a band: `data` holds rows first_row, first_row + 1, ...
+    // of a width x height image and only those rows may be accessed (see TiledBloom.h).
+    // Bands can't be copied.
+    MyImage(int width, int height, int channels, T* data, int first_row = 0);
+
+    // Converting constructor, e.g. MyImage<float> from a MyImage<double> reference
+    template <typename U>
+    explicit MyImage(const MyImage<U>& other)
+        : width(other.width), height(other.height), channels(other.channels),
+          path(nullptr), image_{}, data_(nullptr), allocator_(&GetDefaultImageAllocator()) {
+        AllocateData();
+        const U* src = other.GetRawData();
+        const ptrdiff_t total_size = (ptrdiff_t)GetSize();
+        // Parallel, so the pages are first touched by the threads that use them
+        #pragma omp parallel for schedule(static) if(total_size > 65536)
+        for (ptrdiff_t i = 0; i < total_size; ++i) {
+            data_[i] = static_cast<T>(src[i]);
+        }
+    }
+
+    // Copy constructor and assignment operator for proper memory management. A copy uses
+    // the allocator of `other`.
     MyImage(const MyImage& other);
     MyImage& operator=(const MyImage& other);
-    
+
     // Move constructor and assignment operator for efficiency
     MyImage(MyImage&& other) noexcept;
     MyImage& operator=(MyImage&& other) noexcept;
-    
+
     ~MyImage();
-    
+
+    // Number of samples (width * height * channels)
+    inline size_t GetSize() const { return (size_t)width * height * channels; }
+
+    // Start of row y
+    inline const T* GetRow(int y) const { return data_ + (ptrdiff_t)(y - first_row_) * width * channels; }
+    inline T* GetRow(int y) { return data_ + (ptrdiff_t)(y - first_row_) * width * channels; }
+
     // Fast pixel access - inline for maximum performance
-    inline double GetPixel(int x, int y, int channel) const {
-        return data_[y * width * channels + x * channels + channel];
+    inline T GetPixel(int x, int y, int channel) const {
+        return GetRow(y)[x * channels + channel];
     }
-    
-    inline void SetPixel(int x, int y, int channel, double value) {
-        data_[y * width * channels + x * channels + channel] = value;
+
+    inline void SetPixel(int x, int y, int channel, T value) {
+        GetRow(y)[x * channels + channel] = value;
     }
-    
+
+    // First row held by GetRawData(), 0 unless this is a band
+    inline int GetFirstRow() const { return first_row_; }
+
     // Direct data access for optimized operations
-    inline const double* GetRawData() const { return data_; }
-    inline double* GetRawData() { return data_; }
-    
-    void Save(const char* filename);
-    
+    inline const T* GetRawData() const { return data_; }
+    inline T* GetRawData() { return data_; }
+
+    // Format from the extension, see SaveRGBA8(). .pfm keeps the samples unclamped.
+    bool Save(const char* filename, const SaveOptions& options = {});
+
 private:
     const char* path;
     Image image_;
-    double* data_;  // Flat array for cache-friendly access
-    
+    T* data_;  // Flat array for cache-friendly access
+    ImageAllocator* allocator_;   // Of data_ when owned
+    bool owns_data_ = true;
+    int first_row_ = 0;   // First row held by data_, non-zero for bands only
+
     int GetChannelCount_(int format);
     void AllocateData();
     void DeallocateData();
-};
\ No newline at end of file
+    
+    // Fills every row from `src` (same size), or with zeros for nullptr
+    void CopyRows_(const T* src);
+};
+
+// Instantiated in MyImage.cpp
+extern template class MyImage<float>;
+extern template class MyImage<double>;
+
+// Tone curves for the 8-bit output stage
+enum class ToneMap { None, Reinhard, ACES };
+
+template <ToneMap Curve, typename T>
+inline unsigned char ToneMapToByte(T v) {
+    v = std::max(T(0), v);
+    if constexpr (Curve == ToneMap::Reinhard) {
+        v = v / (T(1) + v);
+    } else if constexpr (Curve == ToneMap::ACES) {
+        // Narkowicz's fit of the ACES filmic curve
+        v = (v * (T(2.51) * v + T(0.03))) / (v * (T(2.43) * v + T(0.59)) + T(0.14));
+    }
+    return (unsigned char)(std::min(v, T(1)) * T(255));
+}
+
+template <ToneMap Curve, typename T>
+inline void ConvertRowToRGBA8_(const T* src, Color* dst, int width, int channels, T mult) {
+    for (int x = 0; x < width; ++x) {
+        const T* s = src + x * channels;
+        Color& c = dst[x];
+        
+        if (channels >= 3) {
+            c.r = ToneMapToByte<Curve>(s[0] * mult);
+            c.g = ToneMapToByte<Curve>(s[1] * mult);
+            c.b = ToneMapToByte<Curve>(s[2] * mult);
+        } else {
+            c.r = c.g = c.b = ToneMapToByte<Curve>(s[0] * mult);
+        }
+        
+        // Alpha is scaled and clamped like before, but never tone mapped
+        c.a = (channels == 4 || channels == 2)
+            ? ToneMapToByte<ToneMap::None>(s[channels - 1] * mult)
+            : 255;
+    }
+}
+
+// Converts one row of interleaved samples to RGBA8 in a single sweep: scale by `mult`,
+// apply the tone curve, clamp to [0, 1] and quantize. Gray is replicated to RGB and
+// missing alpha is opaque.
+template <typename T>
+inline void ConvertRowToRGBA8(const T* src, Color* dst, int width, int channels,
+                              T mult = T(1), ToneMap tone_map = ToneMap::None) {
+    switch (tone_map) {
+        case ToneMap::None:
+            ConvertRowToRGBA8_<ToneMap::None>(src, dst, width, channels, mult);
+            break;
+        case ToneMap::Reinhard:
+            ConvertRowToRGBA8_<ToneMap::Reinhard>(src, dst, width, channels, mult);
+            break;
+        case ToneMap::ACES:
+            ConvertRowToRGBA8_<ToneMap::ACES>(src, dst, width, channels, mult);
+            break;
+    }
+}
+
+// Writes an RGBA8 buffer to disk, format picked from the extension: .ppm/.pgm/.pfm/.qoi
+// and .png with options.png_level >= 0 by ImageCodecs, the rest through raylib
+bool SaveRGBA8(const Color* colors, int width, int height, const char* filename,
+               const SaveOptions& options = {});
@@ -0,0 +1,141 @@
+#pragma once
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#if defined(__linux__)
+#include <dirent.h>
+#include <sched.h>
+#endif
+
+// NUMA nodes and their CPUs, for pinning the ThreadPool workers (see BLOOM_PIN in
+// ThreadPool.h) and for the per-node bandwidth report of bloom_bench.
+//
+// Read from /sys/devices/system/node on Linux and limited to the CPUs this process may run
+// on (taskset, cgroups). Anywhere else, or without that directory, all CPUs are one node
+// and pinning does nothing.
+
+class NumaTopology {
+public:
+    static const NumaTopology& Get() {
+        static const NumaTopology topology;
+        return topology;
+    }
+
+    inline int GetNodeCount() const { return (int)node_cpus_.size(); }
+
+    // CPUs of node n (the index into the nodes found, not the kernel's node number)
+    inline const std::vector<int>& GetCpus(int node) const { return node_cpus_[node]; }
+
+    // Every CPU, node by node
+    inline const std::vector<int>& GetAllCpus() const { return all_cpus_; }
+
+private:
+    std::vector<std::vector<int>> node_cpus_;
+    std::vector<int> all_cpus_;
+
+    NumaTopology() {
+#if defined(__linux__)
+        cpu_set_t allowed;
+        CPU_ZERO(&allowed);
+        const bool have_allowed = sched_getaffinity(0, sizeof(allowed), &allowed) == 0;
+        for (int node : ListNodes_()) {
+            char path[64];
+            std::snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+            FILE* file = std::fopen(path, "r");
+            if (!file) {
+                continue;
+            }
+            char list[4096] = {};
+            const bool read = std::fgets(list, sizeof(list), file) != nullptr;
+            std::fclose(file);
+            std::vector<int> cpus;
+            for (int cpu : read ? ParseCpuList_(list) : std::vector<int>{}) {
+                if (!have_allowed || (cpu < CPU_SETSIZE && CPU_ISSET(cpu, &allowed))) {
+                    cpus.push_back(cpu);
+                }
+            }
+            // Memory-only nodes and nodes we may not run on have nothing to pin to
+            if (!cpus.empty()) {
+                node_cpus_.push_back(cpus);
+            }
+        }
+        if (node_cpus_.empty() && have_allowed) {
+            std::vector<int> cpus;
+            for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+                if (CPU_ISSET(cpu, &allowed)) cpus.push_back(cpu);
+            }
+            node_cpus_.push_back(cpus);
+        }
+#endif
+        if (node_cpus_.empty()) {
+            node_cpus_.emplace_back();
+        }
+        for (const std::vector<int>& cpus : node_cpus_) {
+            all_cpus_.insert(all_cpus_.end(), cpus.begin(), cpus.end());
+        }
+    }
+
+#if defined(__linux__)
+    // Kernel numbers of the nodes, ascending
+    static std::vector<int> ListNodes_() {
+        std::vector<int> nodes;
+        DIR* dir = opendir("/sys/devices/system/node");
+        if (!dir) {
+            return nodes;
+        }
+        while (const dirent* entry = readdir(dir)) {
+            int node;
+            char rest;
+            if (std::sscanf(entry->d_name, "node%d%c", &node, &rest) == 1) {
+                nodes.push_back(node);
+            }
+        }
+        closedir(dir);
+        std::sort(nodes.begin(), nodes.end());
+        return nodes;
+    }
+#endif
+
+    // "0-3,8,10-11"
+    static std::vector<int> ParseCpuList_(const char* list) {
+        std::vector<int> cpus;
+        const char* p = list;
+        while (*p) {
+            char* end;
+            const long first = std::strtol(p, &end, 10);
+            if (end == p) break;
+            long last = first;
+            p = end;
+            if (*p == '-') {
+                last = std::strtol(p + 1, &end, 10);
+                p = end;
+            }
+            for (long cpu = first; cpu <= last; ++cpu) {
+                cpus.push_back((int)cpu);
+            }
+            if (*p != ',') break;
+            ++p;
+        }
+        return cpus;
+    }
+};
+
+// Restricts the calling thread to `cpus`, false if that isn't possible (or supported)
+inline bool PinCurrentThread(const std::vector<int>& cpus) {
+#if defined(__linux__)
+    if (cpus.empty()) {
+        return false;
+    }
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int cpu : cpus) {
+        if (cpu < CPU_SETSIZE) CPU_SET(cpu, &set);
+    }
+    return sched_setaffinity(0, sizeof(set), &set) == 0;
+#else
+    (void)cpus;
+    return false;
+#endif
+}
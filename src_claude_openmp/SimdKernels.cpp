@@ -0,0 +1,90 @@
+#include "SimdKernels.h"
+#include <cstdlib>
+#include <cstring>
+
+#if defined(BLOOM_X86_SIMD) && defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#endif
+
+namespace {
+
+SimdLevel DetectCpuSimdLevel() {
+#if defined(BLOOM_X86_SIMD)
+#if defined(_MSC_VER) && !defined(__clang__)
+    int regs[4];
+    __cpuid(regs, 0);
+    const int max_leaf = regs[0];
+
+    __cpuid(regs, 1);
+    const bool sse42 = (regs[2] & (1 << 20)) != 0;
+    const bool fma = (regs[2] & (1 << 12)) != 0;
+    const bool osxsave = (regs[2] & (1 << 27)) != 0;
+
+    // The OS has to save the YMM/ZMM registers on context switches too
+    const unsigned long long xcr0 = osxsave ? _xgetbv(0) : 0;
+    const bool ymm_state = (xcr0 & 0x6) == 0x6;
+    const bool zmm_state = (xcr0 & 0xe6) == 0xe6;
+
+    bool avx2 = false;
+    bool avx512f = false;
+    if (max_leaf >= 7) {
+        __cpuidex(regs, 7, 0);
+        avx2 = (regs[1] & (1 << 5)) != 0;
+        avx512f = (regs[1] & (1 << 16)) != 0;
+    }
+
+    if (avx512f && avx2 && fma && zmm_state) return SimdLevel::AVX512;
+    if (avx2 && fma && ymm_state) return SimdLevel::AVX2;
+    if (sse42) return SimdLevel::SSE42;
+#else
+    // libgcc/compiler-rt also check that the OS enabled the wider register state
+    __builtin_cpu_init();
+    const bool fma = __builtin_cpu_supports("fma");
+    if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx2") && fma) return SimdLevel::AVX512;
+    if (__builtin_cpu_supports("avx2") && fma) return SimdLevel::AVX2;
+    if (__builtin_cpu_supports("sse4.2")) return SimdLevel::SSE42;
+#endif
+#endif
+    return SimdLevel::Scalar;
+}
+
+SimdKernels MakeSimdKernels(SimdLevel level) {
+    switch (level) {
+#if defined(BLOOM_X86_SIMD)
+        case SimdLevel::AVX512:
+            return {SimdLevel::AVX512, "AVX-512", DownSampleRow_AVX512, UpsampleRow_AVX512,
+                    UpsampleBlendRow_AVX512};
+        case SimdLevel::AVX2:
+            return {SimdLevel::AVX2, "AVX2", DownSampleRow_AVX2, UpsampleRow_AVX2,
+                    UpsampleBlendRow_AVX2};
+        case SimdLevel::SSE42:
+            return {SimdLevel::SSE42, "SSE4.2", DownSampleRow_SSE42, UpsampleRow_SSE42,
+                    UpsampleBlendRow_SSE42};
+#endif
+        default:
+            return {SimdLevel::Scalar, "scalar", nullptr, nullptr, nullptr};
+    }
+}
+
+}  // namespace
+
+SimdLevel DetectSimdLevel() {
+    SimdLevel level = DetectCpuSimdLevel();
+
+    // Optional cap from the environment, never raises the level above what the CPU supports
+    if (const char* forced = std::getenv("BLOOM_SIMD")) {
+        SimdLevel cap = level;
+        if (std::strcmp(forced, "scalar") == 0) cap = SimdLevel::Scalar;
+        else if (std::strcmp(forced, "sse4.2") == 0) cap = SimdLevel::SSE42;
+        else if (std::strcmp(forced, "avx2") == 0) cap = SimdLevel::AVX2;
+        else if (std::strcmp(forced, "avx512") == 0) cap = SimdLevel::AVX512;
+        if (cap < level) level = cap;
+    }
+
+    return level;
+}
+
+const SimdKernels& GetSimdKernels() {
+    static const SimdKernels kernels = MakeSimdKernels(DetectSimdLevel());
+    return kernels;
+}
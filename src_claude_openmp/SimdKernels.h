@@ -0,0 +1,52 @@
+#pragma once
+
+// Hand-vectorized float kernels for DownSample and Upsample.
+//
+// Every instruction set lives in its own SimdKernels_<isa>.cpp compiled with its own
+// -m flags, so the executable itself only assumes baseline x86-64. GetSimdKernels()
+// picks the widest set the CPU supports the first time it is called.
+
+enum class SimdLevel { Scalar, SSE42, AVX2, AVX512 };
+
+// Computes output pixels [col_begin, n) of row `i` of the resampled image and returns n.
+// n - col_begin is the largest multiple of the vector width that fits in col_end - col_begin;
+// the caller finishes [n, col_end) with the scalar kernel. `dst_row` points at column 0.
+// `src` holds source rows src_first_row, src_first_row + 1, ... (0 unless it is a band).
+// Only the first `active_channels` of the `channels` interleaved ones are resampled
+// (channels - 1 skips alpha). Layouts without a specialized kernel (more than 4 channels)
+// return col_begin, leaving the whole range to the scalar kernel.
+using ResampleRowFn = int (*)(const float* src, int src_width, int src_height, int src_first_row,
+                              int channels, int active_channels, float* dst_row, int new_width,
+                              int new_height, int i, int col_begin, int col_end);
+
+// Same as ResampleRowFn, but blends into the row instead of overwriting it:
+// dst = resampled * (1 - t) + dst * t
+using BlendRowFn = int (*)(const float* src, int src_width, int src_height, int src_first_row,
+                           int channels, int active_channels, float* dst_row, int new_width,
+                           int new_height, int i, int col_begin, int col_end, float t);
+
+struct SimdKernels {
+    SimdLevel level;
+    const char* name;
+    ResampleRowFn downsample_row;     // nullptr for SimdLevel::Scalar
+    ResampleRowFn upsample_row;       // nullptr for SimdLevel::Scalar
+    BlendRowFn upsample_blend_row;    // nullptr for SimdLevel::Scalar
+};
+
+// Widest instruction set supported by both the CPU and the OS.
+// BLOOM_SIMD=scalar|sse4.2|avx2|avx512 caps it (handy for benchmarking and testing).
+SimdLevel DetectSimdLevel();
+
+// Kernel table for DetectSimdLevel(), resolved once at startup
+const SimdKernels& GetSimdKernels();
+
+// Per instruction set entry points
+int DownSampleRow_SSE42(const float*, int, int, int, int, int, float*, int, int, int, int, int);
+int UpsampleRow_SSE42(const float*, int, int, int, int, int, float*, int, int, int, int, int);
+int UpsampleBlendRow_SSE42(const float*, int, int, int, int, int, float*, int, int, int, int, int, float);
+int DownSampleRow_AVX2(const float*, int, int, int, int, int, float*, int, int, int, int, int);
+int UpsampleRow_AVX2(const float*, int, int, int, int, int, float*, int, int, int, int, int);
+int UpsampleBlendRow_AVX2(const float*, int, int, int, int, int, float*, int, int, int, int, int, float);
+int DownSampleRow_AVX512(const float*, int, int, int, int, int, float*, int, int, int, int, int);
+int UpsampleRow_AVX512(const float*, int, int, int, int, int, float*, int, int, int, int, int);
+int UpsampleBlendRow_AVX512(const float*, int, int, int, int, int, float*, int, int, int, int, int, float);
@@ -0,0 +1,200 @@
+#pragma once
+
+// Shared body of the SimdKernels_<isa>.cpp files. Each of them defines a small vector
+// wrapper V (kWidth lanes of float) and instantiates ResampleRow<V> with it.
+//
+// Everything here sits in an anonymous namespace and avoids std:: helpers on purpose:
+// an inline function instantiated in an AVX2 translation unit must never be picked by
+// the linker for code that also runs on older CPUs.
+
+#include <stddef.h>
+
+namespace {
+
+// Same taps and weights as DownSample()/Upsample() in main.cpp
+constexpr float kDownSampleCoords[13][2] = {
+    {-1.0f,  1.0f}, { 1.0f,  1.0f},
+    {-1.0f, -1.0f}, { 1.0f, -1.0f},
+    {-2.0f,  2.0f}, { 0.0f,  2.0f}, { 2.0f,  2.0f},
+    {-2.0f,  0.0f}, { 0.0f,  0.0f}, { 2.0f,  0.0f},
+    {-2.0f, -2.0f}, { 0.0f, -2.0f}, { 2.0f, -2.0f}
+};
+
+constexpr float kDownSampleWeights[13] = {
+    0.125f, 0.125f, 0.125f, 0.125f,
+    0.0555555f, 0.0555555f, 0.0555555f,
+    0.0555555f, 0.0555555f, 0.0555555f,
+    0.0555555f, 0.0555555f, 0.0555555f
+};
+
+constexpr float kUpsampleCoords[9][2] = {
+    {-1.0f,  1.0f}, { 0.0f,  1.0f}, { 1.0f,  1.0f},
+    {-1.0f,  0.0f}, { 0.0f,  0.0f}, { 1.0f,  0.0f},
+    {-1.0f, -1.0f}, { 0.0f, -1.0f}, { 1.0f, -1.0f}
+};
+
+constexpr float kUpsampleWeights[9] = {
+    0.0625f, 0.125f,  0.0625f,
+    0.125f,  0.25f,   0.125f,
+    0.0625f, 0.125f,  0.0625f
+};
+
+inline float ClampUnit(float v) {
+    return v < 0.0f ? 0.0f : (v > 1.0f ? 1.0f : v);
+}
+
+// Compile-time int, so the channel count can be passed to a generic lambda
+template <int N>
+struct Int {
+    static constexpr int value = N;
+};
+
+// Vectorized version of the scalar tap loop: V::kWidth output pixels of row i per iteration,
+// all channels at once, starting at column col_begin. `offset` is 0.5 for DownSample (pixel
+// centers) and 0.0 for Upsample.
+// With Blend the result is mixed into dst_row (dst = result * (1 - t) + dst * t).
+// Pixels have C interleaved channels, of which the first A are resampled; the others are
+// neither read nor written (A = C - 1 skips alpha).
+template <class V, bool Blend, int Taps, int C, int A>
+int ResampleRow(const float (&coords)[Taps][2], const float (&weights)[Taps], float offset,
+                const float* src, int src_width, int src_height, int src_first_row,
+                float* dst_row, int new_width, int new_height, int i, int col_begin, int col_end,
+                float t) {
+    const int n = col_end - (col_end - col_begin) % V::kWidth;
+    if (n == col_begin) {
+        return col_begin;
+    }
+
+    const float inv_new_w = 1.0f / new_width;
+    const float inv_new_h = 1.0f / new_height;
+    const ptrdiff_t stride = (ptrdiff_t)src_width * C;
+
+    // Vertical position of every tap is the same for the whole row
+    const float* row0[Taps];
+    const float* row1[Taps];
+    float dy[Taps];
+    for (int k = 0; k < Taps; ++k) {
+        float y = ClampUnit((i + offset + coords[k][1]) * inv_new_h);
+        float py = y * (src_height - 1);
+        int y0 = (int)py;
+        int y1 = y0 + 1 < src_height - 1 ? y0 + 1 : src_height - 1;
+        dy[k] = py - y0;
+        row0[k] = src + (y0 - src_first_row) * stride;
+        row1[k] = src + (y1 - src_first_row) * stride;
+    }
+
+    const typename V::f zero = V::set1(0.0f);
+    const typename V::f one = V::set1(1.0f);
+    const typename V::f lane = V::iota();
+    const typename V::f max_x = V::set1((float)(src_width - 1));
+    const typename V::i max_xi = V::set1i(src_width - 1);
+    const typename V::i one_i = V::set1i(1);
+    const typename V::i channels_i = V::set1i(C);
+
+    alignas(64) float out[A][V::kWidth];
+
+    for (int j = col_begin; j < n; j += V::kWidth) {
+        typename V::f acc[A];
+        for (int ch = 0; ch < A; ++ch) {
+            acc[ch] = zero;
+        }
+        const typename V::f base = V::add(V::set1((float)j), lane);
+
+        for (int k = 0; k < Taps; ++k) {
+            // Horizontal bilinear setup, shared by all channels
+            typename V::f x = V::mul(V::add(V::add(base, V::set1(offset)), V::set1(coords[k][0])),
+                                     V::set1(inv_new_w));
+            x = V::max(zero, V::min(x, one));
+            typename V::f px = V::mul(x, max_x);
+            typename V::i x0 = V::cvtt(px);
+            typename V::i x1 = V::mini(V::addi(x0, one_i), max_xi);
+            typename V::f dx = V::sub(px, V::cvt(x0));
+            typename V::i idx0 = C == 1 ? x0 : V::mullo(x0, channels_i);
+            typename V::i idx1 = C == 1 ? x1 : V::mullo(x1, channels_i);
+
+            const typename V::f fy = V::set1(dy[k]);
+            const typename V::f weight = V::set1(weights[k]);
+
+            for (int ch = 0; ch < A; ++ch) {
+                typename V::f top_left = V::gather(row0[k] + ch, idx0);
+                typename V::f top_right = V::gather(row0[k] + ch, idx1);
+                typename V::f bottom_left = V::gather(row1[k] + ch, idx0);
+                typename V::f bottom_right = V::gather(row1[k] + ch, idx1);
+
+                typename V::f top = V::fmadd(dx, V::sub(top_right, top_left), top_left);
+                typename V::f bottom = V::fmadd(dx, V::sub(bottom_right, bottom_left), bottom_left);
+                typename V::f value = V::fmadd(fy, V::sub(bottom, top), top);
+                acc[ch] = V::fmadd(value, weight, acc[ch]);
+            }
+        }
+
+        // Back to interleaved pixels
+        for (int ch = 0; ch < A; ++ch) {
+            V::store(out[ch], acc[ch]);
+        }
+        float* dst = dst_row + j * C;
+        for (int l = 0; l < V::kWidth; ++l) {
+            for (int ch = 0; ch < A; ++ch) {
+                if (Blend) {
+                    dst[l * C + ch] = out[ch][l] * (1.0f - t) + dst[l * C + ch] * t;
+                } else {
+                    dst[l * C + ch] = out[ch][l];
+                }
+            }
+        }
+    }
+
+    return n;
+}
+
+// Picks the ResampleRow instantiation for (channels, active_channels), nothing vectorized
+// for layouts it has none for
+template <class V, bool Blend, int Taps>
+int ResampleRowChannels(const float (&coords)[Taps][2], const float (&weights)[Taps], float offset,
+                        const float* src, int src_width, int src_height, int src_first_row,
+                        int channels, int active_channels, float* dst_row, int new_width, int new_height,
+                        int i, int col_begin, int col_end, float t) {
+    auto run = [&](auto c, auto a) {
+        return ResampleRow<V, Blend, Taps, decltype(c)::value, decltype(a)::value>(
+            coords, weights, offset, src, src_width, src_height, src_first_row, dst_row,
+            new_width, new_height, i, col_begin, col_end, t);
+    };
+    switch (channels * 8 + active_channels) {
+        case 1 * 8 + 1: return run(Int<1>(), Int<1>());
+        case 2 * 8 + 1: return run(Int<2>(), Int<1>());
+        case 2 * 8 + 2: return run(Int<2>(), Int<2>());
+        case 3 * 8 + 3: return run(Int<3>(), Int<3>());
+        case 4 * 8 + 3: return run(Int<4>(), Int<3>());
+        case 4 * 8 + 4: return run(Int<4>(), Int<4>());
+        default: return col_begin;
+    }
+}
+
+template <class V>
+int DownSampleRow(const float* src, int src_width, int src_height, int src_first_row, int channels,
+                  int active_channels, float* dst_row, int new_width, int new_height, int i,
+                  int col_begin, int col_end) {
+    return ResampleRowChannels<V, false>(kDownSampleCoords, kDownSampleWeights, 0.5f, src, src_width, src_height,
+                                         src_first_row, channels, active_channels, dst_row, new_width, new_height,
+                                         i, col_begin, col_end, 0.0f);
+}
+
+template <class V>
+int UpsampleRow(const float* src, int src_width, int src_height, int src_first_row, int channels,
+                int active_channels, float* dst_row, int new_width, int new_height, int i,
+                int col_begin, int col_end) {
+    return ResampleRowChannels<V, false>(kUpsampleCoords, kUpsampleWeights, 0.0f, src, src_width, src_height,
+                                         src_first_row, channels, active_channels, dst_row, new_width, new_height,
+                                         i, col_begin, col_end, 0.0f);
+}
+
+template <class V>
+int UpsampleBlendRow(const float* src, int src_width, int src_height, int src_first_row, int channels,
+                     int active_channels, float* dst_row, int new_width, int new_height, int i,
+                     int col_begin, int col_end, float t) {
+    return ResampleRowChannels<V, true>(kUpsampleCoords, kUpsampleWeights, 0.0f, src, src_width, src_height,
+                                        src_first_row, channels, active_channels, dst_row, new_width, new_height,
+                                        i, col_begin, col_end, t);
+}
+
+}  // namespace
@@ -0,0 +1,55 @@
+// AVX-512F kernels (compiled with -mavx512f -mavx2 -mfma), 16 output pixels per iteration.
+#include <immintrin.h>
+#include "SimdKernels.h"
+#include "SimdKernelsImpl.h"
+
+namespace {
+
+struct Avx512 {
+    static constexpr int kWidth = 16;
+    using f = __m512;
+    using i = __m512i;
+
+    static f set1(float v) { return _mm512_set1_ps(v); }
+    static i set1i(int v) { return _mm512_set1_epi32(v); }
+    static f iota() {
+        return _mm512_set_ps(15.0f, 14.0f, 13.0f, 12.0f, 11.0f, 10.0f, 9.0f, 8.0f,
+                             7.0f, 6.0f, 5.0f, 4.0f, 3.0f, 2.0f, 1.0f, 0.0f);
+    }
+    static f add(f a, f b) { return _mm512_add_ps(a, b); }
+    static f sub(f a, f b) { return _mm512_sub_ps(a, b); }
+    static f mul(f a, f b) { return _mm512_mul_ps(a, b); }
+    static f min(f a, f b) { return _mm512_min_ps(a, b); }
+    static f max(f a, f b) { return _mm512_max_ps(a, b); }
+    static f fmadd(f a, f b, f c) { return _mm512_fmadd_ps(a, b, c); }
+    static i cvtt(f a) { return _mm512_cvttps_epi32(a); }
+    static f cvt(i a) { return _mm512_cvtepi32_ps(a); }
+    static i addi(i a, i b) { return _mm512_add_epi32(a, b); }
+    static i mini(i a, i b) { return _mm512_min_epi32(a, b); }
+    static i mullo(i a, i b) { return _mm512_mullo_epi32(a, b); }
+    static void store(float* p, f v) { _mm512_store_ps(p, v); }
+    static f gather(const float* base, i idx) { return _mm512_i32gather_ps(idx, base, 4); }
+};
+
+}  // namespace
+
+int DownSampleRow_AVX512(const float* src, int src_width, int src_height, int src_first_row,
+                         int channels, int active_channels, float* dst_row, int new_width,
+                         int new_height, int i, int col_begin, int col_end) {
+    return DownSampleRow<Avx512>(src, src_width, src_height, src_first_row, channels, active_channels, dst_row,
+                                 new_width, new_height, i, col_begin, col_end);
+}
+
+int UpsampleRow_AVX512(const float* src, int src_width, int src_height, int src_first_row,
+                       int channels, int active_channels, float* dst_row, int new_width,
+                       int new_height, int i, int col_begin, int col_end) {
+    return UpsampleRow<Avx512>(src, src_width, src_height, src_first_row, channels, active_channels, dst_row,
+                               new_width, new_height, i, col_begin, col_end);
+}
+
+int UpsampleBlendRow_AVX512(const float* src, int src_width, int src_height, int src_first_row,
+                            int channels, int active_channels, float* dst_row, int new_width,
+                            int new_height, int i, int col_begin, int col_end, float t) {
+    return UpsampleBlendRow<Avx512>(src, src_width, src_height, src_first_row, channels, active_channels, dst_row,
+                                    new_width, new_height, i, col_begin, col_end, t);
+}
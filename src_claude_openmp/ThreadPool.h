@@ -0,0 +1,406 @@
+#pragma once
+#include <Numa.h>
+#include <Trace.h>
+#include <assert.h>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <omp.h>
+
+// Persistent worker threads running task graphs, shared by every BloomContext.
+//
+// Each worker keeps a deque of ready tasks. A worker that finishes a task pushes the tasks
+// it unblocked onto its own deque and pops from the same end, so the rows it just wrote
+// are read again while still in its cache. A worker whose deque is empty steals from the
+// other end of the others' deques, and only sleeps once there is nothing left to steal.
+// Nothing waits on a barrier or spins on a dependency, so slower cores just end up
+// running fewer tasks.
+//
+// The first tasks of a graph are dealt out in contiguous blocks, and ParallelBlocks() hands
+// block b to worker b, so memory first touched through ParallelBlocks() is mostly used by
+// the worker that touched it. With BLOOM_PIN=node each worker is pinned to one NUMA node
+// (consecutive workers on the same node), with BLOOM_PIN=core to one CPU. Stealing still
+// moves tasks across nodes when that balances the load, so the placement is approximate.
+
+// Dependencies between the tasks of one graph, see ThreadPool::Run()
+struct TaskGraph {
+    std::vector<int> dependencies;      // [task] number of tasks it waits for
+    std::vector<int> successor_begin;   // [task] first of its successors, GetSize() + 1 entries
+    std::vector<int> successors;        // Tasks waiting for task t: [successor_begin[t], successor_begin[t + 1])
+
+    inline int GetSize() const { return (int)dependencies.size(); }
+
+    // From the list of tasks each task waits for (duplicates are ignored)
+    static TaskGraph FromDependencies(std::vector<std::vector<int>> waits_for) {
+        TaskGraph graph;
+        const int n = (int)waits_for.size();
+        graph.dependencies.assign(n, 0);
+        graph.successor_begin.assign(n + 1, 0);
+        for (int t = 0; t < n; ++t) {
+            std::vector<int>& deps = waits_for[t];
+            std::sort(deps.begin(), deps.end());
+            deps.erase(std::unique(deps.begin(), deps.end()), deps.end());
+            graph.dependencies[t] = (int)deps.size();
+            for (int d : deps) {
+                assert(d >= 0 && d < n && d != t);
+                ++graph.successor_begin[d + 1];
+            }
+        }
+        for (int t = 0; t < n; ++t) {
+            graph.successor_begin[t + 1] += graph.successor_begin[t];
+        }
+        graph.successors.resize(graph.successor_begin[n]);
+        std::vector<int> fill(graph.successor_begin.begin(), graph.successor_begin.end() - 1);
+        for (int t = 0; t < n; ++t) {
+            for (int d : waits_for[t]) {
+                graph.successors[fill[d]++] = t;
+            }
+        }
+        return graph;
+    }
+};
+
+class ThreadPool {
+public:
+    // The process-wide pool, created on first use with a worker per core (or more if
+    // OpenMP was already asked for more threads)
+    static ThreadPool& Get() {
+        static ThreadPool pool(std::max(omp_get_num_procs(), omp_get_max_threads()));
+        return pool;
+    }
+
+    explicit ThreadPool(int threads) : workers_(std::max(threads, 1)) {
+        Place_(std::getenv("BLOOM_PIN"));
+        for (int w = 0; w < (int)workers_.size(); ++w) {
+            workers_[w].thread = std::thread([this, w] { WorkerLoop_(w); });
+        }
+    }
+
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+            for (Worker& worker : workers_) {
+                worker.wake.notify_one();
+            }
+        }
+        for (Worker& worker : workers_) {
+            worker.thread.join();
+        }
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    inline int GetThreadCount() const { return (int)workers_.size(); }
+
+    // Index of the NumaTopology node worker w is pinned to, -1 if it isn't pinned
+    inline int GetWorkerNode(int w) const { return workers_[w].node; }
+
+    // Runs fn(block, blocks) once for every block in [0, blocks) and returns when all of them
+    // are done. Block b runs on worker b and is never stolen, and `blocks` is the number of
+    // workers Run() would use, so splitting memory into `blocks` contiguous parts and first
+    // touching part b in block b puts it on the NUMA node of the worker that gets the
+    // matching first tasks of a graph. Same rules for the caller as Run().
+    template <typename Fn>
+    void ParallelBlocks(const Fn& fn) {
+        const int blocks = GetRunThreads_();
+        if (blocks == 1) {
+            fn(0, 1);
+            return;
+        }
+
+        auto run = [&](int block, int) { fn(block, blocks); };
+        Job job;
+        job.graph = nullptr;
+        job.pending = nullptr;
+        job.fn = &run;
+        job.run = [](const void* f, int task, int thread) { (*static_cast<const decltype(run)*>(f))(task, thread); };
+        job.threads = blocks;
+        job.pinned = true;
+        job.remaining.store(blocks, std::memory_order_relaxed);
+        for (int b = 0; b < blocks; ++b) {
+            Push_(b, {&job, b});
+        }
+        Wait_(job);
+    }
+
+    // Runs fn(task, thread) for every task of `graph`, each one once all the tasks it waits
+    // for are done, and returns when all of them are. Like an OpenMP region it uses
+    // omp_get_max_threads() of the calling thread (at most GetThreadCount()) workers;
+    // `thread` is the worker, for per-thread scratch. `pending` holds a counter per task.
+    // Graphs from different threads may run at the same time. The caller only waits, it
+    // must not be one of the workers. With a single thread the caller runs every task itself
+    // (as thread 0), e.g. one image per thread in BloomBatch. `max_threads` > 0 lowers the
+    // thread count further, e.g. to a tuned one.
+    template <typename Fn>
+    void Run(const TaskGraph& graph, std::atomic<int>* pending, const Fn& fn, int max_threads = 0) {
+        const int n = graph.GetSize();
+        if (n == 0) {
+            return;
+        }
+        const int threads = max_threads > 0 ? std::min(max_threads, GetRunThreads_()) : GetRunThreads_();
+        if (threads == 1) {
+            RunInline_(graph, pending, fn);
+            return;
+        }
+
+        Job job;
+        job.graph = &graph;
+        job.pending = pending;
+        job.fn = &fn;
+        job.run = [](const void* f, int task, int thread) { (*static_cast<const Fn*>(f))(task, thread); };
+        job.threads = threads;
+        job.remaining.store(n, std::memory_order_relaxed);
+        int seeds = 0;
+        for (int t = 0; t < n; ++t) {
+            pending[t].store(graph.dependencies[t], std::memory_order_relaxed);
+            seeds += graph.dependencies[t] == 0;
+        }
+
+        // Tasks without dependencies in graph order, a contiguous block of them per worker
+        // like ParallelBlocks()
+        int seed = 0;
+        for (int t = 0; t < n; ++t) {
+            if (graph.dependencies[t] == 0) {
+                Push_((int)((long long)seed++ * job.threads / seeds), {&job, t});
+            }
+        }
+        Wait_(job);
+    }
+
+private:
+    // Run() on the calling thread: sweeps the tasks in graph order, running every one whose
+    // dependencies are done (-1 marks a task as run). A single sweep for graphs already in
+    // dependency order, like the BloomContext ones.
+    template <typename Fn>
+    static void RunInline_(const TaskGraph& graph, std::atomic<int>* pending, const Fn& fn) {
+        const int n = graph.GetSize();
+        for (int t = 0; t < n; ++t) {
+            pending[t].store(graph.dependencies[t], std::memory_order_relaxed);
+        }
+        for (int left = n; left > 0;) {
+            for (int t = 0; t < n; ++t) {
+                if (pending[t].load(std::memory_order_relaxed) != 0) {
+                    continue;
+                }
+                fn(t, 0);
+                pending[t].store(-1, std::memory_order_relaxed);
+                for (int s = graph.successor_begin[t]; s < graph.successor_begin[t + 1]; ++s) {
+                    pending[graph.successors[s]].fetch_sub(1, std::memory_order_relaxed);
+                }
+                --left;
+            }
+        }
+    }
+
+    struct Job {
+        const TaskGraph* graph;
+        std::atomic<int>* pending;
+        const void* fn;
+        void (*run)(const void* fn, int task, int thread);
+        int threads;                    // Workers [0, threads) run its tasks
+        bool pinned = false;            // Tasks run where they were pushed, see ParallelBlocks()
+        std::atomic<int> remaining;
+        std::mutex mutex;
+        std::condition_variable done;
+        bool finished = false;
+    };
+
+    struct Item {
+        Job* job;
+        int task;
+    };
+
+    // Ring buffer deque: the owner works at the back, thieves take from the front. Grows
+    // when full and never shrinks, so steady-state frames allocate nothing.
+    struct Worker {
+        std::mutex mutex;
+        std::vector<Item> items = std::vector<Item>(64);
+        size_t head = 0;
+        size_t size = 0;
+        std::thread thread;
+        std::vector<int> cpus;          // Pinned to these CPUs, unless empty
+        int node = -1;
+
+        // Under ThreadPool::mutex_
+        bool sleeping = false;
+        bool woken = false;
+        std::condition_variable wake;
+    };
+
+    // Yields before a worker goes to sleep: tasks usually come from other running ones
+    static constexpr int kIdleSpins = 64;
+
+    std::vector<Worker> workers_;
+    std::atomic<int> queued_{0};        // Items in every deque
+    std::atomic<int> sleepers_{0};
+    std::mutex mutex_;
+    bool stop_ = false;
+
+    inline int GetRunThreads_() const {
+        return std::max(1, std::min(omp_get_max_threads(), GetThreadCount()));
+    }
+
+    // CPUs of every worker for BLOOM_PIN=node|core, nothing for anything else
+    void Place_(const char* pin) {
+        const NumaTopology& topology = NumaTopology::Get();
+        const int n = GetThreadCount();
+        if (topology.GetAllCpus().empty()) {
+            return;
+        }
+        if (pin && std::strcmp(pin, "node") == 0) {
+            for (int w = 0; w < n; ++w) {
+                workers_[w].node = (int)((long long)w * topology.GetNodeCount() / n);
+                workers_[w].cpus = topology.GetCpus(workers_[w].node);
+            }
+        } else if (pin && std::strcmp(pin, "core") == 0) {
+            const std::vector<int>& cpus = topology.GetAllCpus();
+            for (int w = 0; w < n; ++w) {
+                const int cpu = cpus[w % cpus.size()];
+                workers_[w].cpus = {cpu};
+                for (int node = 0; node < topology.GetNodeCount(); ++node) {
+                    const std::vector<int>& node_cpus = topology.GetCpus(node);
+                    if (std::find(node_cpus.begin(), node_cpus.end(), cpu) != node_cpus.end()) {
+                        workers_[w].node = node;
+                    }
+                }
+            }
+        }
+    }
+
+    void Wait_(Job& job) {
+        std::unique_lock<std::mutex> lock(job.mutex);
+        job.done.wait(lock, [&] { return job.finished; });
+    }
+
+    void Push_(int w, Item item) {
+        Worker& worker = workers_[w];
+        {
+            std::lock_guard<std::mutex> lock(worker.mutex);
+            if (worker.size == worker.items.size()) {
+                std::vector<Item> items(worker.items.size() * 2);
+                for (size_t k = 0; k < worker.size; ++k) {
+                    items[k] = worker.items[(worker.head + k) % worker.items.size()];
+                }
+                worker.items.swap(items);
+                worker.head = 0;
+            }
+            worker.items[(worker.head + worker.size++) % worker.items.size()] = item;
+        }
+        queued_.fetch_add(1);
+
+        // Wake the owner of the deque, or else any worker that may steal the item
+        if (sleepers_.load() > 0) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            Worker* target = worker.sleeping && !worker.woken ? &worker : nullptr;
+            for (int v = 0; !target && !item.job->pinned && v < item.job->threads; ++v) {
+                if (workers_[v].sleeping && !workers_[v].woken) {
+                    target = &workers_[v];
+                }
+            }
+            if (target) {
+                target->woken = true;
+                target->wake.notify_one();
+            }
+        }
+    }
+
+    // Newest item of worker v when it is w itself, its oldest one otherwise (stealing,
+    // only from graphs w works for). With `peek` the item stays where it is.
+    bool Take_(int w, int v, Item& item, bool peek = false) {
+        Worker& worker = workers_[v];
+        std::lock_guard<std::mutex> lock(worker.mutex);
+        if (worker.size == 0) {
+            return false;
+        }
+        const size_t k = v == w ? worker.head + worker.size - 1 : worker.head;
+        item = worker.items[k % worker.items.size()];
+        if (item.job->threads <= w || (v != w && item.job->pinned)) {
+            return false;
+        }
+        if (!peek) {
+            if (v != w) {
+                worker.head = (worker.head + 1) % worker.items.size();
+            }
+            --worker.size;
+            queued_.fetch_sub(1);
+        }
+        return true;
+    }
+
+    bool Find_(int w, Item& item, bool peek = false) {
+        const int n = GetThreadCount();
+        for (int k = 0; k < n; ++k) {
+            if (Take_(w, (w + k) % n, item, peek)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void Execute_(int w, const Item& item) {
+        Job& job = *item.job;
+        job.run(job.fn, item.task, w);
+
+        if (job.graph) {
+            const TaskGraph& graph = *job.graph;
+            for (int s = graph.successor_begin[item.task]; s < graph.successor_begin[item.task + 1]; ++s) {
+                const int successor = graph.successors[s];
+                if (job.pending[successor].fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                    Push_(w, {&job, successor});
+                }
+            }
+        }
+
+        // The last task wakes the caller, `job` goes away as soon as it has
+        if (job.remaining.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            std::lock_guard<std::mutex> lock(job.mutex);
+            job.finished = true;
+            job.done.notify_one();
+        }
+    }
+
+    void WorkerLoop_(int w) {
+        Worker& worker = workers_[w];
+        PinCurrentThread(worker.cpus);
+        Item item;
+        for (;;) {
+            if (Find_(w, item)) {
+                Execute_(w, item);
+                continue;
+            }
+
+            bool found = false;
+            for (int spin = 0; spin < kIdleSpins && !found; ++spin) {
+                std::this_thread::yield();
+                found = queued_.load() > 0 && Find_(w, item, true);
+            }
+            if (found) {
+                continue;
+            }
+
+            // Registered as a sleeper before the last look, so a push either shows up in
+            // that look or wakes this worker
+            BLOOM_TRACE_SCOPE("Pool idle");
+            std::unique_lock<std::mutex> lock(mutex_);
+            worker.sleeping = true;
+            sleepers_.fetch_add(1);
+            if (!stop_ && !Find_(w, item, true)) {
+                worker.wake.wait(lock, [&] { return worker.woken || stop_; });
+            }
+            worker.sleeping = false;
+            worker.woken = false;
+            sleepers_.fetch_sub(1);
+            if (stop_) {
+                return;
+            }
+        }
+    }
+};
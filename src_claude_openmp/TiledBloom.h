@@ -0,0 +1,403 @@
+#pragma once
+#include <Bloom.h>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+// Out-of-core bloom for images that don't fit in memory.
+//
+// The source is streamed from a raw file in horizontal strips and the RGBA8 result is
+// written out strip by strip. Pyramid levels live in LevelStores: in memory while they fit
+// the memory budget (coarsest first, they are the smallest), in a temporary file otherwise.
+// Every pass only keeps the strip it produces plus the band of halo rows the taps of that
+// strip read, so peak memory is bounded by the budget instead of the image size.
+// The result is identical to BloomContext::BloomToRGBA8 on the whole image.
+//
+// Raw files are headerless, row-major, interleaved 8-bit samples (what `ffmpeg -f rawvideo`
+// and ImageMagick's `gray:`/`rgb:`/`rgba:` formats read and write).
+
+// Seeks to a 64-bit byte offset, plain fseek() stops at 2 GB on some platforms
+inline bool Seek64(FILE* file, int64_t offset) {
+#if defined(_WIN32)
+    return _fseeki64(file, offset, SEEK_SET) == 0;
+#else
+    return fseeko(file, (off_t)offset, SEEK_SET) == 0;
+#endif
+}
+
+// Random row access to a raw 8-bit image, converted to normalized samples on the fly
+template <typename T>
+class RawImageReader {
+public:
+    RawImageReader(const char* path, int width, int channels)
+        : file_(std::fopen(path, "rb")), width_(width), channels_(channels),
+          row_bytes_((size_t)width * channels) {}
+    ~RawImageReader() { if (file_) std::fclose(file_); }
+
+    RawImageReader(const RawImageReader&) = delete;
+    RawImageReader& operator=(const RawImageReader&) = delete;
+
+    inline bool IsOpen() const { return file_ != nullptr; }
+    inline size_t GetBufferBytes() const { return row_bytes_; }
+
+    // Reads rows [first, first + count) into `dst`, one row at a time
+    bool ReadRows(int first, int count, T* dst) {
+        if (!Seek64(file_, (int64_t)first * (int64_t)row_bytes_)) {
+            return false;
+        }
+
+        buffer_.resize(row_bytes_);
+        const T inv255 = T(1) / T(255);
+        for (int y = 0; y < count; ++y) {
+            if (std::fread(buffer_.data(), 1, row_bytes_, file_) != row_bytes_) {
+                return false;
+            }
+            T* row = dst + (ptrdiff_t)y * width_ * channels_;
+            for (size_t k = 0; k < row_bytes_; ++k) {
+                row[k] = buffer_[k] * inv255;
+            }
+        }
+        return true;
+    }
+
+private:
+    FILE* file_;
+    int width_;
+    int channels_;
+    size_t row_bytes_;
+    std::vector<unsigned char> buffer_;
+};
+
+// One pyramid level, kept in memory or spilled to an anonymous temporary file
+template <typename T>
+class LevelStore {
+public:
+    LevelStore(int width, int height, int channels, bool resident)
+        : width(width), height(height), channels(channels), file_(nullptr) {
+        if (resident) {
+            data_.resize((size_t)width * height * channels);
+        } else {
+            file_ = std::tmpfile();
+        }
+    }
+    ~LevelStore() { if (file_) std::fclose(file_); }
+
+    LevelStore(const LevelStore&) = delete;
+    LevelStore& operator=(const LevelStore&) = delete;
+
+    int width;
+    int height;
+    int channels;
+
+    inline bool IsResident() const { return file_ == nullptr; }
+    inline bool IsOpen() const { return IsResident() || file_ != nullptr; }
+
+    bool ReadRows(int first, int count, T* dst) {
+        size_t n = (size_t)count * width * channels;
+        if (IsResident()) {
+            std::memcpy(dst, data_.data() + RowOffset_(first), n * sizeof(T));
+            return true;
+        }
+        return Seek64(file_, (int64_t)RowOffset_(first) * (int64_t)sizeof(T)) &&
+               std::fread(dst, sizeof(T), n, file_) == n;
+    }
+
+    bool WriteRows(int first, int count, const T* src) {
+        size_t n = (size_t)count * width * channels;
+        if (IsResident()) {
+            std::memcpy(data_.data() + RowOffset_(first), src, n * sizeof(T));
+            return true;
+        }
+        return Seek64(file_, (int64_t)RowOffset_(first) * (int64_t)sizeof(T)) &&
+               std::fwrite(src, sizeof(T), n, file_) == n;
+    }
+
+private:
+    std::vector<T> data_;
+    FILE* file_;
+
+    inline size_t RowOffset_(int y) const { return (size_t)y * width * channels; }
+};
+
+// Sliding window of consecutive rows [first, first + count) of some source. Moving the
+// window forward keeps the overlapping rows and only reads the new ones.
+template <typename T>
+class RowBand {
+public:
+    explicit RowBand(size_t capacity) : data_(capacity) {}
+
+    inline T* GetData() { return data_.data(); }
+    inline int GetFirstRow() const { return first_; }
+    inline void Reset() { first_ = 0; count_ = 0; }
+
+    // Makes the band hold rows [begin, end) of `source` (row_size samples per row)
+    template <typename Source>
+    bool Fetch(Source& source, int begin, int end, size_t row_size) {
+        assert((size_t)(end - begin) * row_size <= data_.size());
+
+        int keep_begin = std::max(begin, first_);
+        int keep_end = std::min(end, first_ + count_);
+        int read_begin = begin;
+        if (keep_begin == begin && keep_end > keep_begin) {
+            std::memmove(data_.data(), data_.data() + (size_t)(keep_begin - first_) * row_size,
+                         (size_t)(keep_end - keep_begin) * row_size * sizeof(T));
+            read_begin = keep_end;
+        }
+
+        first_ = begin;
+        count_ = end - begin;
+        return read_begin >= end ||
+               source.ReadRows(read_begin, end - read_begin, data_.data() + (size_t)(read_begin - begin) * row_size);
+    }
+
+private:
+    std::vector<T> data_;
+    int first_ = 0;
+    int count_ = 0;
+};
+
+struct TiledBloomOptions {
+    size_t memory_budget = size_t(512) << 20;   // Bytes
+    int levels = 8;
+    int max_strip_rows = 256;                    // Halved until the strip buffers fit
+    BloomOutput output;
+};
+
+struct TiledBloomResult {
+    bool ok = false;
+    const char* error = nullptr;
+    int strip_rows = 0;
+    int resident_levels = 0;
+    int spilled_levels = 0;
+    size_t peak_bytes = 0;                       // Working memory, excluding the stdio buffers
+};
+
+namespace tiled_bloom_detail {
+
+// Strip buffers needed for strips of `strip_rows` rows: fine-side band and coarse-side band
+// of each pass (see TiledBloomRaw), in samples
+template <typename T>
+void StripBufferSizes(const std::vector<int>& widths, const std::vector<int>& heights, int channels,
+                      const std::vector<DownSampleAxis<T>>& rows, int strip_rows,
+                      size_t& fine_size, size_t& coarse_size) {
+    int levels = (int)widths.size() - 1;
+    fine_size = (size_t)std::min(strip_rows, heights[0]) * widths[0] * channels;
+    coarse_size = 0;
+
+    for (int k = 1; k <= levels; ++k) {
+        for (int r0 = 0; r0 < heights[k]; r0 += strip_rows) {
+            int r1 = std::min(heights[k], r0 + strip_rows);
+            int a = 0;
+            int b = 0;
+            DownSampleSourceRows(rows[k - 1], heights[k - 1], r0, r1, a, b);
+            fine_size = std::max(fine_size, (size_t)(b - a) * widths[k - 1] * channels);
+            coarse_size = std::max(coarse_size, (size_t)(r1 - r0) * widths[k] * channels);
+        }
+        for (int r0 = 0; r0 < heights[k - 1]; r0 += strip_rows) {
+            int r1 = std::min(heights[k - 1], r0 + strip_rows);
+            int a = 0;
+            int b = 0;
+            UpsampleSourceRows(heights[k], heights[k - 1], r0, r1, a, b);
+            coarse_size = std::max(coarse_size, (size_t)(b - a) * widths[k] * channels);
+        }
+    }
+}
+
+}  // namespace tiled_bloom_detail
+
+// Blooms the raw image at `input_path` into an RGBA8 raw image at `output_path`.
+//
+// Passes, all in strips of at most strip_rows output rows:
+//   1. DownSample chain: level k strips from bands of level k - 1 (level 0 is the input file)
+//   2. UpsampleBlend chain: level k - 1 strips blended with bands of level k, written back
+//   3. Output: input strips blended with bands of level 1, converted and appended to the output
+template <typename T = float>
+TiledBloomResult TiledBloomRaw(const char* input_path, const char* output_path,
+                               int width, int height, int channels,
+                               const TiledBloomOptions& options = {}) {
+    TiledBloomResult result;
+    int levels = options.levels;
+
+    // Level sizes and tap tables, as in BloomContext
+    std::vector<int> widths(1, width);
+    std::vector<int> heights(1, height);
+    std::vector<DownSampleAxis<T>> cols;
+    std::vector<DownSampleAxis<T>> rows;
+    size_t table_bytes = 0;
+    for (int k = 0; k < levels; ++k) {
+        cols.emplace_back(DownSampledSize(widths[k]), widths[k], channels);
+        rows.emplace_back(DownSampledSize(heights[k]), heights[k], 1);
+        widths.push_back(DownSampledSize(widths[k]));
+        heights.push_back(DownSampledSize(heights[k]));
+        table_bytes += (cols[k].lo.size() + rows[k].lo.size()) * (2 * sizeof(int) + sizeof(T));
+    }
+
+    // Largest strip whose buffers fit the budget
+    RawImageReader<T> input(input_path, width, channels);
+    size_t fixed_bytes = table_bytes + input.GetBufferBytes();
+    size_t fine_size = 0;
+    size_t coarse_size = 0;
+    size_t strip_bytes = 0;
+    int strip_rows = std::max(1, options.max_strip_rows);
+    for (;; strip_rows /= 2) {
+        tiled_bloom_detail::StripBufferSizes(widths, heights, channels, rows, strip_rows, fine_size, coarse_size);
+        strip_bytes = (fine_size + coarse_size) * sizeof(T) + (size_t)strip_rows * width * sizeof(Color);
+        if (fixed_bytes + strip_bytes <= options.memory_budget || strip_rows == 1) {
+            break;
+        }
+    }
+    if (fixed_bytes + strip_bytes > options.memory_budget) {
+        result.error = "memory budget too small for a single row strip";
+        return result;
+    }
+    result.strip_rows = strip_rows;
+    result.peak_bytes = fixed_bytes + strip_bytes;
+
+    // Keep whatever levels still fit in memory, starting with the smallest
+    std::vector<bool> resident(levels + 1, false);
+    for (int k = levels; k >= 1; --k) {
+        size_t level_bytes = (size_t)widths[k] * heights[k] * channels * sizeof(T);
+        if (result.peak_bytes + level_bytes <= options.memory_budget) {
+            resident[k] = true;
+            result.peak_bytes += level_bytes;
+        }
+    }
+
+    if (!input.IsOpen()) {
+        result.error = "can't open the input file";
+        return result;
+    }
+    FILE* output = std::fopen(output_path, "wb");
+    if (!output) {
+        result.error = "can't open the output file";
+        return result;
+    }
+
+    std::vector<std::unique_ptr<LevelStore<T>>> stores(levels + 1);
+    for (int k = 1; k <= levels; ++k) {
+        stores[k] = std::make_unique<LevelStore<T>>(widths[k], heights[k], channels, resident[k]);
+        (resident[k] ? result.resident_levels : result.spilled_levels)++;
+    }
+
+    RowBand<T> fine(fine_size);
+    RowBand<T> coarse(coarse_size);
+    std::vector<Color> colors((size_t)strip_rows * width);
+    const T t = T(kBloomLerpWeight);
+    bool ok = true;
+
+    for (int k = 1; k <= levels && ok; ++k) {
+        ok = stores[k]->IsOpen();
+    }
+    if (!ok) {
+        result.error = "can't create a temporary file";
+    }
+
+    // 1. DownSample chain
+    for (int k = 1; k <= levels && ok; ++k) {
+        BLOOM_TRACE_SCOPE("Tiled DownSample level", TraceArgs{.level = k, .width = widths[k], .height = heights[k],
+                                                              .channels = channels});
+        size_t src_row_size = (size_t)widths[k - 1] * channels;
+        fine.Reset();
+
+        for (int r0 = 0; r0 < heights[k] && ok; r0 += strip_rows) {
+            int r1 = std::min(heights[k], r0 + strip_rows);
+            int a = 0;
+            int b = 0;
+            DownSampleSourceRows(rows[k - 1], heights[k - 1], r0, r1, a, b);
+            ok = k == 1 ? fine.Fetch(input, a, b, src_row_size)
+                        : fine.Fetch(*stores[k - 1], a, b, src_row_size);
+            if (!ok) {
+                result.error = "read error";
+                break;
+            }
+
+            const MyImage<T> src(widths[k - 1], heights[k - 1], channels, fine.GetData(), a);
+            MyImage<T> dst(widths[k], heights[k], channels, coarse.GetData(), r0);
+            DownSampleRows(src, dst, cols[k - 1], rows[k - 1], r0, r1);
+
+            ok = stores[k]->WriteRows(r0, r1 - r0, coarse.GetData());
+            if (!ok) {
+                result.error = "write error";
+            }
+        }
+    }
+
+    // 2. UpsampleBlend chain down to level 1
+    for (int k = levels; k > 1 && ok; --k) {
+        BLOOM_TRACE_SCOPE("Tiled Upsample level", TraceArgs{.level = k - 1, .width = widths[k - 1],
+                                                            .height = heights[k - 1], .channels = channels});
+        size_t src_row_size = (size_t)widths[k] * channels;
+        coarse.Reset();
+
+        for (int r0 = 0; r0 < heights[k - 1] && ok; r0 += strip_rows) {
+            int r1 = std::min(heights[k - 1], r0 + strip_rows);
+            int a = 0;
+            int b = 0;
+            UpsampleSourceRows(heights[k], heights[k - 1], r0, r1, a, b);
+            ok = coarse.Fetch(*stores[k], a, b, src_row_size) &&
+                 stores[k - 1]->ReadRows(r0, r1 - r0, fine.GetData());
+            if (!ok) {
+                result.error = "read error";
+                break;
+            }
+
+            const MyImage<T> src(widths[k], heights[k], channels, coarse.GetData(), a);
+            MyImage<T> dst(widths[k - 1], heights[k - 1], channels, fine.GetData(), r0);
+            #pragma omp parallel for schedule(dynamic, 16) if(r1 - r0 > 64)
+            for (int i = r0; i < r1; ++i) {
+                UpsampleRow<true>(src, dst.GetRow(i), dst.width, dst.height, i, 0, dst.width, t);
+            }
+
+            ok = stores[k - 1]->WriteRows(r0, r1 - r0, fine.GetData());
+            if (!ok) {
+                result.error = "write error";
+            }
+        }
+    }
+
+    // 3. Final blend with the input, converted and written out progressively
+    BLOOM_TRACE_SCOPE("Tiled output", TraceArgs{.level = 0, .width = width, .height = height, .channels = channels});
+    coarse.Reset();
+    T mult = T(options.output.mult);
+    for (int r0 = 0; r0 < height && ok; r0 += strip_rows) {
+        int r1 = std::min(height, r0 + strip_rows);
+        int a = 0;
+        int b = 0;
+        if (levels > 0) {
+            UpsampleSourceRows(heights[1], height, r0, r1, a, b);
+            ok = coarse.Fetch(*stores[1], a, b, (size_t)widths[1] * channels);
+        }
+        ok = ok && input.ReadRows(r0, r1 - r0, fine.GetData());
+        if (!ok) {
+            result.error = "read error";
+            break;
+        }
+
+        MyImage<T> dst(width, height, channels, fine.GetData(), r0);
+        #pragma omp parallel for schedule(dynamic, 16) if(r1 - r0 > 64)
+        for (int i = r0; i < r1; ++i) {
+            if (levels > 0) {
+                const MyImage<T> src(widths[1], heights[1], channels, coarse.GetData(), a);
+                UpsampleRow<true>(src, dst.GetRow(i), width, height, i, 0, width, t);
+            }
+            ConvertRowToRGBA8(dst.GetRow(i), colors.data() + (ptrdiff_t)(i - r0) * width, width, channels,
+                              mult, options.output.tone_map);
+        }
+
+        size_t n = (size_t)(r1 - r0) * width;
+        ok = std::fwrite(colors.data(), sizeof(Color), n, output) == n;
+        if (!ok) {
+            result.error = "write error";
+        }
+    }
+
+    if (std::fclose(output) != 0 && ok) {
+        ok = false;
+        result.error = "write error";
+    }
+
+    result.ok = ok;
+    return result;
+}
@@ -0,0 +1,107 @@
+#include "Trace.h"
+
+#if defined(BLOOM_TRACE)
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace {
+
+struct TraceEvent {
+    const char* name;
+    TraceArgs args;
+    double start_us;
+    double duration_us;
+};
+
+// One per thread that ever recorded a span. Owned by the registry so the events of
+// threads that already exited are still there at export time.
+struct ThreadBuffer {
+    int tid;
+    std::vector<TraceEvent> events;
+};
+
+std::atomic<bool> g_enabled(false);
+std::mutex g_registry_mutex;
+std::vector<std::unique_ptr<ThreadBuffer>> g_registry;
+const std::chrono::steady_clock::time_point g_epoch = std::chrono::steady_clock::now();
+
+ThreadBuffer& GetThreadBuffer() {
+    thread_local ThreadBuffer* buffer = nullptr;
+    if (!buffer) {
+        std::lock_guard<std::mutex> lock(g_registry_mutex);
+        g_registry.push_back(std::make_unique<ThreadBuffer>());
+        buffer = g_registry.back().get();
+        buffer->tid = (int)g_registry.size();
+        buffer->events.reserve(1024);
+    }
+    return *buffer;
+}
+
+double NowUs() {
+    return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - g_epoch).count();
+}
+
+}  // namespace
+
+TraceScope::TraceScope(const char* name, const TraceArgs& args)
+    : name_(g_enabled.load(std::memory_order_relaxed) ? name : nullptr), args_(args), start_us_(0.0) {
+    if (name_) {
+        start_us_ = NowUs();
+    }
+}
+
+TraceScope::~TraceScope() {
+    if (name_) {
+        double end_us = NowUs();
+        GetThreadBuffer().events.push_back({name_, args_, start_us_, end_us - start_us_});
+    }
+}
+
+void TraceSetEnabled(bool enabled) {
+    g_enabled.store(enabled, std::memory_order_relaxed);
+}
+
+bool TraceWriteChromeJson(const char* path) {
+    FILE* file = std::fopen(path, "w");
+    if (!file) {
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(g_registry_mutex);
+    std::fprintf(file, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [");
+    bool first = true;
+    for (const std::unique_ptr<ThreadBuffer>& buffer : g_registry) {
+        std::fprintf(file, "%s\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %d, "
+                     "\"args\": {\"name\": \"thread %d\"}}", first ? "" : ",", buffer->tid, buffer->tid);
+        first = false;
+
+        for (const TraceEvent& event : buffer->events) {
+            std::fprintf(file, ",\n{\"name\": \"%s\", \"cat\": \"bloom\", \"ph\": \"X\", \"pid\": 1, \"tid\": %d, "
+                         "\"ts\": %.3f, \"dur\": %.3f, \"args\": {",
+                         event.name, buffer->tid, event.start_us, event.duration_us);
+            const char* separator = "";
+            if (event.args.level >= 0) {
+                std::fprintf(file, "\"level\": %d", event.args.level);
+                separator = ", ";
+            }
+            if (event.args.width > 0) {
+                std::fprintf(file, "%s\"width\": %d, \"height\": %d, \"channels\": %d", separator,
+                             event.args.width, event.args.height, event.args.channels);
+                separator = ", ";
+            }
+            if (event.args.bytes > 0) {
+                std::fprintf(file, "%s\"bytes\": %zu", separator, event.args.bytes);
+            }
+            std::fprintf(file, "}}");
+        }
+    }
+    std::fprintf(file, "\n]}\n");
+    return std::fclose(file) == 0;
+}
+
+#endif
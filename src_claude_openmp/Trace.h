@@ -0,0 +1,64 @@
+#pragma once
+#include <cstddef>
+
+// Opt-in instrumentation: timed spans exported as Chrome-trace JSON (chrome://tracing,
+// https://ui.perfetto.dev).
+//
+// Spans are only compiled in with BLOOM_TRACE defined (cmake -DBLOOM_TRACE=ON). Without it
+// BLOOM_TRACE_SCOPE expands to nothing, its arguments aren't even evaluated, and the hot
+// loops are exactly what they would be without instrumentation.
+//
+// With BLOOM_TRACE, recording still has to be switched on with TraceSetEnabled(true).
+// Every thread appends to its own buffer, so spans inside OpenMP regions don't contend.
+
+// Optional span details, shown under "args" in the trace viewer
+struct TraceArgs {
+    int level = -1;          // Pyramid level, -1 if not applicable
+    int width = 0;           // Dimensions of the image the span produces
+    int height = 0;
+    int channels = 0;
+    size_t bytes = 0;        // Bytes read + written
+};
+
+#if defined(BLOOM_TRACE)
+
+class TraceScope {
+public:
+    explicit TraceScope(const char* name, const TraceArgs& args = {});
+    ~TraceScope();
+
+    TraceScope(const TraceScope&) = delete;
+    TraceScope& operator=(const TraceScope&) = delete;
+
+private:
+    const char* name_;       // nullptr while recording is off
+    TraceArgs args_;
+    double start_us_;
+};
+
+#define BLOOM_TRACE_CONCAT_(a, b) a##b
+#define BLOOM_TRACE_CONCAT(a, b) BLOOM_TRACE_CONCAT_(a, b)
+#define BLOOM_TRACE_SCOPE(...) TraceScope BLOOM_TRACE_CONCAT(trace_scope_, __LINE__)(__VA_ARGS__)
+
+// Starts/stops recording (off by default)
+void TraceSetEnabled(bool enabled);
+
+// Writes every span recorded so far. Not meant to run while spans are still being recorded.
+bool TraceWriteChromeJson(const char* path);
+
+#else
+
+#define BLOOM_TRACE_SCOPE(...) ((void)0)
+
+inline void TraceSetEnabled(bool) {}
+inline bool TraceWriteChromeJson(const char*) { return false; }
+
+#endif
+
+// True if this build records spans at all
+constexpr bool kTraceCompiledIn =
+#if defined(BLOOM_TRACE)
+    true;
+#else
+    false;
+#endif
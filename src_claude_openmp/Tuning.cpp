@@ -0,0 +1,117 @@
+#include <Tuning.h>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+namespace {
+
+constexpr TunedKernel kKernels[] = {TunedKernel::DownSample, TunedKernel::Upsample, TunedKernel::Bloom};
+
+TuningProfile& CurrentProfile() {
+    static TuningProfile profile = [] {
+        TuningProfile loaded;
+        loaded.Load(GetTuningProfilePath().c_str());
+        return loaded;
+    }();
+    return profile;
+}
+
+}  // namespace
+
+const char* GetTunedKernelName(TunedKernel kernel) {
+    switch (kernel) {
+        case TunedKernel::DownSample: return "downsample";
+        case TunedKernel::Upsample: return "upsample";
+        case TunedKernel::Bloom: return "bloom";
+    }
+    return "?";
+}
+
+const KernelTuning* TuningProfile::Find(TunedKernel kernel, long long pixels) const {
+    const KernelTuning* best = nullptr;
+    double best_distance = 0.0;
+    const double size = std::log2((double)std::max(pixels, 1LL));
+    for (const Entry& entry : entries_) {
+        if (entry.kernel != kernel) {
+            continue;
+        }
+        const double distance = std::abs(std::log2((double)std::max(entry.pixels, 1LL)) - size);
+        if (!best || distance < best_distance) {
+            best = &entry.tuning;
+            best_distance = distance;
+        }
+    }
+    return best;
+}
+
+void TuningProfile::Set(TunedKernel kernel, long long pixels, const KernelTuning& tuning) {
+    for (Entry& entry : entries_) {
+        if (entry.kernel == kernel && entry.pixels == pixels) {
+            entry.tuning = tuning;
+            return;
+        }
+    }
+    entries_.push_back({kernel, pixels, tuning});
+}
+
+bool TuningProfile::Load(const char* path) {
+    entries_.clear();
+    FILE* file = std::fopen(path, "r");
+    if (!file) {
+        return false;
+    }
+    char line[256];
+    bool ok = true;
+    while (ok && std::fgets(line, sizeof(line), file)) {
+        if (line[0] == '#' || line[0] == '\n') {
+            continue;
+        }
+        char name[32];
+        long long pixels;
+        KernelTuning tuning;
+        ok = std::sscanf(line, "%31s %lld %d %d %d", name, &pixels, &tuning.threads, &tuning.tile_width,
+                         &tuning.tile_height) == 5 && tuning.threads > 0;
+        bool known = false;
+        for (TunedKernel kernel : kKernels) {
+            if (ok && std::strcmp(name, GetTunedKernelName(kernel)) == 0) {
+                Set(kernel, pixels, tuning);
+                known = true;
+            }
+        }
+        ok = ok && known;
+    }
+    std::fclose(file);
+    if (!ok) {
+        entries_.clear();
+    }
+    return ok;
+}
+
+bool TuningProfile::Save(const char* path) const {
+    FILE* file = std::fopen(path, "w");
+    if (!file) {
+        return false;
+    }
+    std::fprintf(file, "# Bloom_CPP --autotune profile\n");
+    std::fprintf(file, "# kernel, output pixels, threads, tile width, tile height (-1 -1: not tuned)\n");
+    for (const Entry& entry : entries_) {
+        std::fprintf(file, "%s %lld %d %d %d\n", GetTunedKernelName(entry.kernel), entry.pixels,
+                     entry.tuning.threads, entry.tuning.tile_width, entry.tuning.tile_height);
+    }
+    return std::fclose(file) == 0;
+}
+
+std::string GetTuningProfilePath() {
+    const char* env = std::getenv("BLOOM_TUNE");
+    return env && *env ? env : "bloom_tuning.txt";
+}
+
+const TuningProfile& GetTuningProfile() {
+    return CurrentProfile();
+}
+
+void SetTuningProfile(const TuningProfile& profile) {
+    CurrentProfile() = profile;
+}
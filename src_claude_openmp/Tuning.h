@@ -0,0 +1,66 @@
+#pragma once
+#include <string>
+#include <vector>
+
+// Per-machine tuning of the thread counts and block shapes, measured by Bloom_CPP --autotune.
+//
+// A profile holds, for each tuned kernel and each output size it was measured at, the
+// fastest thread count and ResampleTile shape (see Bloom.h). A kernel call uses the entry
+// measured at the size nearest to its own on a log scale, so each pyramid level picks its
+// own configuration. Without an entry the built-in defaults apply.
+//
+// The profile comes from BLOOM_TUNE=<path> on first use, or from bloom_tuning.txt in the
+// working directory. A missing file means no profile. The file is plain text, one entry
+// per line:
+//   <kernel> <output pixels> <threads> <tile width> <tile height>
+// with kernel one of downsample, upsample, bloom and a tile of -1 -1 for "not tuned".
+
+enum class TunedKernel {
+    DownSample,   // DownSampleRows(), and the DownSample tasks of BloomContext
+    Upsample,     // UpsampleInto(), and the Upsample/blend tasks of BloomContext
+    Bloom,        // A whole BloomContext frame: its thread count
+};
+
+struct KernelTuning {
+    int threads = 0;           // 1 runs the kernel without a parallel region
+    int tile_width = -1;       // ResampleTile, -1 keeps GetResampleTile()
+    int tile_height = -1;
+
+    inline bool HasTile() const { return tile_width >= 0 && tile_height >= 0; }
+};
+
+class TuningProfile {
+public:
+    struct Entry {
+        TunedKernel kernel;
+        long long pixels;      // Output size it was measured at
+        KernelTuning tuning;
+    };
+
+    // Entry of `kernel` measured nearest to `pixels`, nullptr if there is none
+    const KernelTuning* Find(TunedKernel kernel, long long pixels) const;
+
+    // Adds or replaces the entry of `kernel` at `pixels`
+    void Set(TunedKernel kernel, long long pixels, const KernelTuning& tuning);
+
+    inline bool IsEmpty() const { return entries_.empty(); }
+    inline const std::vector<Entry>& GetEntries() const { return entries_; }
+
+    // False if the file can't be read or has a malformed line (the profile is then empty)
+    bool Load(const char* path);
+    bool Save(const char* path) const;
+
+private:
+    std::vector<Entry> entries_;
+};
+
+const char* GetTunedKernelName(TunedKernel kernel);
+
+// Where the profile is loaded from: BLOOM_TUNE or bloom_tuning.txt
+std::string GetTuningProfilePath();
+
+// The process-wide profile, loaded on first use
+const TuningProfile& GetTuningProfile();
+
+// Replaces it for every later kernel call, not meant to race with running ones
+void SetTuningProfile(const TuningProfile& profile);
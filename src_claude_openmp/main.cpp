@@ -3,12 +3,25 @@
 #include <string>
 #include <vector>
 #include <cstring>
+#include <cstdlib>
 #include <MyImage.h>
-#include <assert.h>
+#include <Bloom.h>
+#include <TiledBloom.h>
+#include <FrameStream.h>
+#include <FixedBloom.h>
+#include <BudgetBloom.h>
+#include <Trace.h>
+#include <Tuning.h>
 #include <chrono>
 #include <algorithm>
+#include <cmath>
 #include <omp.h>
 
+#if defined(_WIN32)
+#include <fcntl.h>
+#include <io.h>
+#endif
+
 void DisplayImage(const char* path) {
     int WindowWidth = 700;
     int WindowHeight = 700;
@@ -30,251 +43,372 @@ void DisplayImage(const char* path) {
     CloseWindow();
 }
 
-// Optimized bilinear sampling with direct data access
-inline double BilinearTap(const double* data, int width, int height, int channels, 
-                         double x, double y, int channel) {
-    // Map normalized coordinates to pixel coordinates
-    double px = x * (width - 1);
-    double py = y * (height - 1);
-    
-    int x0 = (int)px;
-    int y0 = (int)py;
-    int x1 = std::min(x0 + 1, width - 1);
-    int y1 = std::min(y0 + 1, height - 1);
-    
-    double dx = px - x0;
-    double dy = py - y0;
-    
-    // Direct memory access for speed
-    int stride = width * channels;
-    const double* row0 = data + y0 * stride;
-    const double* row1 = data + y1 * stride;
-    
-    double top_left = row0[x0 * channels + channel];
-    double top_right = row0[x1 * channels + channel];
-    double bottom_left = row1[x0 * channels + channel];
-    double bottom_right = row1[x1 * channels + channel];
-    
-    // Optimized interpolation
-    double top = top_left + dx * (top_right - top_left);
-    double bottom = bottom_left + dx * (bottom_right - bottom_left);
-    return top + dy * (bottom - top);
-}
-
-MyImage Upsample(const MyImage& image) {
-    int new_h = image.height * 2;
-    int new_w = image.width * 2;
-    int c = image.channels;
-    
-    MyImage upsampled(new_w, new_h, c);
-    
-    // Pre-computed kernel weights and offsets
-    static const double coords[9][2] = {
-        {-1.0,  1.0}, { 0.0,  1.0}, { 1.0,  1.0},
-        {-1.0,  0.0}, { 0.0,  0.0}, { 1.0,  0.0},
-        {-1.0, -1.0}, { 0.0, -1.0}, { 1.0, -1.0}
-    };
-    
-    static const double weights[9] = {
-        0.0625, 0.125,  0.0625,
-        0.125,  0.25,   0.125,
-        0.0625, 0.125,  0.0625
-    };
-    
-    const double* src_data = image.GetRawData();
-    double* dst_data = upsampled.GetRawData();
-    
-    int dst_stride = new_w * c;
-    double inv_new_w = 1.0 / new_w;
-    double inv_new_h = 1.0 / new_h;
+// Function to set optimal number of threads based on system and image size
+void SetOptimalThreadCount(int image_size) {
+    int max_threads = omp_get_max_threads();
+    int optimal_threads;
     
-    // Parallel processing of rows with OpenMP
-    #pragma omp parallel for schedule(dynamic, 16) if(new_h > 64)
-    for (int i = 0; i < new_h; ++i) {
-        double* dst_row = dst_data + i * dst_stride;
-        
-        for (int j = 0; j < new_w; ++j) {
-            double* dst_pixel = dst_row + j * c;
-            
-            for (int ch = 0; ch < c; ++ch) {
-                double acc = 0.0;
-                
-                // Unrolled loop for better performance
-                for (int k = 0; k < 9; ++k) {
-                    double x = (j + coords[k][0]) * inv_new_w;
-                    double y = (i + coords[k][1]) * inv_new_h;
-                    
-                    // Clamp coordinates
-                    x = std::max(0.0, std::min(x, 1.0));
-                    y = std::max(0.0, std::min(y, 1.0));
-                    
-                    acc += BilinearTap(src_data, image.width, image.height, c, x, y, ch) * weights[k];
-                }
-                
-                dst_pixel[ch] = acc;
-            }
-        }
+    // Measured on this machine by --autotune if there is a profile, otherwise by image size
+    if (const KernelTuning* tuning = GetTuningProfile().Find(TunedKernel::Bloom, image_size)) {
+        optimal_threads = std::min(tuning->threads, max_threads);
+    } else if (image_size < 512 * 512) {
+        optimal_threads = std::min(4, max_threads);  // Small images don't benefit from many threads
+    } else if (image_size < 1024 * 1024) {
+        optimal_threads = std::min(8, max_threads);
+    } else {
+        optimal_threads = max_threads;  // Large images can use all threads
     }
-    
-    return upsampled;
+    omp_set_num_threads(optimal_threads);
+    std::cout << "Set thread count to: " << optimal_threads << " (max available: " << max_threads << ")\n";
 }
 
-MyImage DownSample(const MyImage& image) {
-    int new_h = image.height / 2;
-    int new_w = image.width / 2;
-    int c = image.channels;
-    
-    MyImage downsampled(new_w, new_h, c);
-    
-    // Pre-computed coordinates and weights
-    static const double coords[13][2] = {
-        {-1.0,  1.0}, { 1.0,  1.0},
-        {-1.0, -1.0}, { 1.0, -1.0},
-        {-2.0,  2.0}, { 0.0,  2.0}, { 2.0,  2.0},
-        {-2.0,  0.0}, { 0.0,  0.0}, { 2.0,  0.0},
-        {-2.0, -2.0}, { 0.0, -2.0}, { 2.0, -2.0}
-    };
+// Runs Bloom on the given image and returns the elapsed time in seconds
+template <typename T>
+double TimeBloom(MyImage<T>& image) {
+    auto start = std::chrono::high_resolution_clock::now();
+    Bloom(image);
+    auto end = std::chrono::high_resolution_clock::now();
     
-    static const double weights[13] = {
-        0.125, 0.125, 0.125, 0.125,
-        0.0555555, 0.0555555, 0.0555555,
-        0.0555555, 0.0555555, 0.0555555,
-        0.0555555, 0.0555555, 0.0555555
-    };
+    std::chrono::duration<double> elapsed = end - start;
+    return elapsed.count();
+}
+
+// Out-of-core mode for images too large to hold in memory:
+//   --tiled <input.raw> <output.raw> <width> <height> <channels> [budget_mb]
+// Input is raw interleaved 8-bit samples, output is raw RGBA8 (see TiledBloom.h)
+int RunTiled(int argc, const char** argv) {
+    if (argc < 7) {
+        std::cerr << "usage: " << argv[0] << " --tiled <input.raw> <output.raw> <width> <height> <channels> [budget_mb]\n";
+        return 1;
+    }
     
-    const double* src_data = image.GetRawData();
-    double* dst_data = downsampled.GetRawData();
+    TiledBloomOptions options;
+    if (argc > 7) {
+        options.memory_budget = (size_t)std::atoll(argv[7]) << 20;
+    }
     
-    int dst_stride = new_w * c;
-    double inv_new_w = 1.0 / new_w;
-    double inv_new_h = 1.0 / new_h;
+    auto start = std::chrono::high_resolution_clock::now();
+    TiledBloomResult result = TiledBloomRaw<float>(argv[2], argv[3], std::atoi(argv[4]), std::atoi(argv[5]),
+                                                   std::atoi(argv[6]), options);
+    auto end = std::chrono::high_resolution_clock::now();
     
-    // Parallel processing with dynamic scheduling for load balancing
-    #pragma omp parallel for schedule(dynamic, 8) if(new_h > 32)
-    for (int i = 0; i < new_h; ++i) {
-        double* dst_row = dst_data + i * dst_stride;
-        
-        for (int j = 0; j < new_w; ++j) {
-            double* dst_pixel = dst_row + j * c;
-            
-            for (int ch = 0; ch < c; ++ch) {
-                double acc = 0.0;
-                
-                for (int k = 0; k < 13; ++k) {
-                    double x = (j + 0.5 + coords[k][0]) * inv_new_w;
-                    double y = (i + 0.5 + coords[k][1]) * inv_new_h;
-                    
-                    x = std::max(0.0, std::min(x, 1.0));
-                    y = std::max(0.0, std::min(y, 1.0));
-                    
-                    acc += BilinearTap(src_data, image.width, image.height, c, x, y, ch) * weights[k];
-                }
-                
-                dst_pixel[ch] = acc;
-            }
-        }
+    if (!result.ok) {
+        std::cerr << "Tiled bloom failed: " << result.error << "\n";
+        return 1;
     }
     
-    return downsampled;
+    std::chrono::duration<double> elapsed = end - start;
+    std::cout << "Strip rows: " << result.strip_rows << ", levels in memory: " << result.resident_levels
+              << ", spilled to disk: " << result.spilled_levels << "\n";
+    std::cout << "Peak working memory: " << (result.peak_bytes >> 20) << " MB\n";
+    std::cout << "Elapsed time (tiled): " << elapsed.count() << " seconds\n";
+    return 0;
 }
 
-MyImage Lerp(const MyImage& a, const MyImage& b, double t) {
-    assert(a.width == b.width && a.height == b.height && a.channels == b.channels);
+// Filter mode for video pipelines, raw frames from stdin to stdout:
+//   --stream <width> <height> <channels> [levels] [threshold] [temporal]
+// Everything else goes to stderr so stdout only carries frames (see FrameStream.h)
+int RunStream(int argc, const char** argv) {
+    if (argc < 5) {
+        std::cerr << "usage: " << argv[0] << " --stream <width> <height> <channels> [levels] [threshold] [temporal]\n";
+        return 1;
+    }
     
-    MyImage result(a.width, a.height, a.channels);
+#if defined(_WIN32)
+    _setmode(_fileno(stdin), _O_BINARY);
+    _setmode(_fileno(stdout), _O_BINARY);
+#endif
     
-    const double* a_data = a.GetRawData();
-    const double* b_data = b.GetRawData();
-    double* result_data = result.GetRawData();
+    FrameStreamOptions options;
+    if (argc > 5) {
+        options.levels = std::atoi(argv[5]);
+    }
+    if (argc > 6) {
+        options.prefilter.threshold = std::atof(argv[6]);
+        options.prefilter.karis = true;
+    }
+    // Reuse levels up to 16 pixels across frames while their source changes by less than this
+    if (argc > 7) {
+        options.temporal.max_level_size = 16;
+        options.temporal.threshold = std::atof(argv[7]);
+    }
     
-    int total_elements = a.width * a.height * a.channels;
-    double inv_t = 1.0 - t;
+    auto start = std::chrono::high_resolution_clock::now();
+    FrameStreamResult result = StreamBloom<float>(stdin, stdout, std::atoi(argv[2]), std::atoi(argv[3]),
+                                                  std::atoi(argv[4]), options);
+    auto end = std::chrono::high_resolution_clock::now();
     
-    // Highly parallel vectorized operation
-    #pragma omp parallel for schedule(static) if(total_elements > 10000)
-    for (int i = 0; i < total_elements; ++i) {
-        result_data[i] = a_data[i] * inv_t + b_data[i] * t;
+    std::chrono::duration<double> elapsed = end - start;
+    std::cerr << "Frames: " << result.frames << " in " << elapsed.count() << " seconds ("
+              << result.frames / elapsed.count() << " fps)\n";
+    if (options.temporal.IsEnabled()) {
+        std::cerr << "Coarse levels reused: " << result.reused_levels << "\n";
     }
-    
-    return result;
+    if (!result.ok) {
+        std::cerr << "Stream failed: " << result.error << "\n";
+        return 1;
+    }
+    return 0;
 }
 
-void Bloom(MyImage& image, int samples = 8) {
-    std::cout << "Using " << omp_get_max_threads() << " threads for parallel processing\n";
-    
-    // Reserve space to avoid reallocations
-    std::vector<MyImage> downsampled_list;
-    downsampled_list.reserve(samples + 1);
+// Measures thread counts and ResampleTile shapes of the resampling kernels, then thread
+// counts of whole frames, at 16:9 sizes up to max_width, and saves the fastest of each as
+// the tuning profile later runs load (see Tuning.h):
+//   --autotune [profile] [max_width]
+int RunAutotune(int argc, const char** argv) {
+    const std::string path = argc > 2 ? argv[2] : GetTuningProfilePath();
+    const int max_width = argc > 3 ? std::atoi(argv[3]) : 1920;
+    if (max_width < 2) {
+        std::cerr << "usage: " << argv[0] << " --autotune [profile] [max_width]\n";
+        return 1;
+    }
+    if (std::getenv("BLOOM_TILE")) {
+        std::cerr << "BLOOM_TILE is set, tile shapes are not tuned\n";
+    }
     
-    // Add the original image
-    downsampled_list.emplace_back(std::move(image));
+    std::vector<int> thread_counts;
+    for (int threads = 1; threads < omp_get_max_threads(); threads *= 2) {
+        thread_counts.push_back(threads);
+    }
+    thread_counts.push_back(omp_get_max_threads());
+    const ResampleTile tiles[] = {{0, 0}, {0, 4}, {0, 32}, {256, 16}, {128, 32}, {64, 64}};
     
-    // Downsample chain - Sequential due to dependencies
-    // std::cout << "Downsampling chain...\n";
-    for (int i = 0; i < samples; ++i) {
-        downsampled_list.emplace_back(DownSample(downsampled_list.back()));
+    std::vector<std::pair<int, int>> sizes;
+    for (int width = max_width; width >= 120 || sizes.empty(); width /= 2) {
+        sizes.insert(sizes.begin(), {width, std::max(1, width * 9 / 16)});
     }
     
-    // Upsample chain with lerping - Sequential due to dependencies
-    // std::cout << "Upsampling and blending...\n";
-    constexpr double lerp_weight = 0.2;
-    MyImage temp = std::move(downsampled_list[samples]);
+    // Best of repeated runs, at least 5 and ~50 ms worth
+    auto measure = [](const auto& run) {
+        run();
+        double best = 1e30;
+        double total = 0.0;
+        for (int r = 0; r < 5 || (total < 0.05 && r < 1000); ++r) {
+            auto start = std::chrono::high_resolution_clock::now();
+            run();
+            std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start;
+            best = std::min(best, elapsed.count());
+            total += elapsed.count();
+        }
+        return best;
+    };
     
-    for (int i = samples; i > 0; --i) {
-        MyImage upsampled = Upsample(temp);
-        temp = Lerp(upsampled, downsampled_list[i-1], lerp_weight);
-    }
+    // Every candidate is measured with the profile found so far plus its own entry
+    TuningProfile profile;
+    auto measure_with = [&](TunedKernel kernel, long long pixels, const KernelTuning& tuning, const auto& run) {
+        TuningProfile trial = profile;
+        trial.Set(kernel, pixels, tuning);
+        SetTuningProfile(trial);
+        return measure(run);
+    };
+    auto report = [](TunedKernel kernel, int width, int height, const KernelTuning& tuning, double best,
+                     double fallback) {
+        std::cout << GetTunedKernelName(kernel) << " " << width << "x" << height << ": " << tuning.threads
+                  << " threads";
+        if (tuning.HasTile()) {
+            std::cout << ", tile " << tuning.tile_width << "x" << tuning.tile_height;
+        }
+        std::cout << ", " << best * 1e3 << " ms (defaults " << fallback * 1e3 << " ms)\n";
+    };
     
-    // Final multiplication and clamping - Highly parallel
-    // std::cout << "Final processing...\n";
-    constexpr double mult = 6.0;
-    double* data = temp.GetRawData();
-    int total_elements = temp.width * temp.height * temp.channels;
+    for (TunedKernel kernel : {TunedKernel::DownSample, TunedKernel::Upsample}) {
+        for (auto [width, height] : sizes) {
+            // DownSample from a level twice the size, Upsample from one half the size
+            const bool down = kernel == TunedKernel::DownSample;
+            const MyImage<float> src(down ? width * 2 : DownSampledSize(width),
+                                     down ? height * 2 : DownSampledSize(height), 4);
+            MyImage<float> dst(width, height, 4);
+            const DownSampleAxis<float> cols(dst.width, src.width, src.channels);
+            const DownSampleAxis<float> rows(dst.height, src.height, 1);
+            auto run = [&] {
+                if (down) {
+                    DownSampleInto(src, dst, cols, rows);
+                } else {
+                    UpsampleBlend(src, dst, 0.5f);
+                }
+            };
+            
+            SetTuningProfile(profile);
+            const double fallback = measure(run);
+            KernelTuning best_tuning;
+            double best = 1e30;
+            for (int threads : thread_counts) {
+                for (const ResampleTile& tile : tiles) {
+                    const KernelTuning tuning{threads, tile.width, tile.height};
+                    const double elapsed = measure_with(kernel, (long long)width * height, tuning, run);
+                    if (elapsed < best) {
+                        best = elapsed;
+                        best_tuning = tuning;
+                    }
+                }
+            }
+            profile.Set(kernel, (long long)width * height, best_tuning);
+            report(kernel, width, height, best_tuning, best, fallback);
+        }
+    }
     
-    #pragma omp parallel for schedule(static) if(total_elements > 10000)
-    for (int i = 0; i < total_elements; ++i) {
-        data[i] = std::max(0.0, std::min(data[i] * mult, 1.0));
+    // Whole frames with the kernel entries above in place
+    for (auto [width, height] : sizes) {
+        const MyImage<float> source(width, height, 4);
+        BloomContext<float> context(width, height, 4);
+        std::vector<Color> colors((size_t)width * height);
+        auto run = [&] { context.BloomToRGBA8(source, colors.data()); };
+        
+        SetTuningProfile(profile);
+        const double fallback = measure(run);
+        KernelTuning best_tuning;
+        double best = 1e30;
+        for (int threads : thread_counts) {
+            const KernelTuning tuning{threads, -1, -1};
+            const double elapsed = measure_with(TunedKernel::Bloom, (long long)width * height, tuning, run);
+            if (elapsed < best) {
+                best = elapsed;
+                best_tuning = tuning;
+            }
+        }
+        profile.Set(TunedKernel::Bloom, (long long)width * height, best_tuning);
+        report(TunedKernel::Bloom, width, height, best_tuning, best, fallback);
     }
     
-    image = std::move(temp);
+    SetTuningProfile(profile);
+    if (!profile.Save(path.c_str())) {
+        std::cerr << "Can't write the tuning profile to " << path << "\n";
+        return 1;
+    }
+    std::cout << "Tuning profile written to " << path << "\n";
+    return 0;
 }
 
-// Function to set optimal number of threads based on system and image size
-void SetOptimalThreadCount(int image_size) {
-    int max_threads = omp_get_max_threads();
-    int optimal_threads;
+// BLOOM_TRACE_FILE=<path> records spans and writes them as Chrome-trace JSON on exit
+// (only in builds configured with -DBLOOM_TRACE=ON, see Trace.h)
+struct TraceSession {
+    const char* path = std::getenv("BLOOM_TRACE_FILE");
+    
+    TraceSession() {
+        if (path && !kTraceCompiledIn) {
+            std::cerr << "BLOOM_TRACE_FILE ignored: built without BLOOM_TRACE\n";
+        }
+        TraceSetEnabled(path != nullptr);
+    }
     
-    // Adjust thread count based on image size and system capabilities
-    if (image_size < 512 * 512) {
-        optimal_threads = std::min(4, max_threads);  // Small images don't benefit from many threads
-    } else if (image_size < 1024 * 1024) {
-        optimal_threads = std::min(8, max_threads);
-    } else {
-        optimal_threads = max_threads;  // Large images can use all threads
+    ~TraceSession() {
+        if (path && kTraceCompiledIn && !TraceWriteChromeJson(path)) {
+            std::cerr << "Can't write the trace to " << path << "\n";
+        }
     }
-    optimal_threads = 10; // for debugging
-    omp_set_num_threads(optimal_threads);
-    std::cout << "Set thread count to: " << optimal_threads << " (max available: " << max_threads << ")\n";
-}
+};
 
 int main(int argc, const char** argv) {
-    MyImage image("images/image2.png");
+    TraceSession trace;
+    
+    if (argc > 1 && std::strcmp(argv[1], "--tiled") == 0) {
+        return RunTiled(argc, argv);
+    }
+    if (argc > 1 && std::strcmp(argv[1], "--stream") == 0) {
+        return RunStream(argc, argv);
+    }
+    if (argc > 1 && std::strcmp(argv[1], "--autotune") == 0) {
+        return RunAutotune(argc, argv);
+    }
+    
+    // double is the reference precision, float is what we ship
+    MyImage<double> reference("images/image2.png");
+    MyImage<float> source(reference);
+    MyImage<float> image(source);
     
     // Set optimal thread count based on image size
     SetOptimalThreadCount(image.width * image.height);
     
+    std::cout << "SIMD kernels: " << GetSimdKernels().name << "\n";
+    std::cout << "Image allocator: " << GetDefaultImageAllocator().GetName() << "\n";
     std::cout << "Image: " << image.width << "x" << image.height << " (" << image.channels << " channels)\n";
+    std::cout << "Using " << omp_get_max_threads() << " threads for parallel processing\n";
     std::cout << "Performing Bloom...\n";
     
+    double elapsed_double = TimeBloom(reference);
+    std::cout << "Elapsed time (double): " << elapsed_double << " seconds\n";
+    
+    double elapsed_float = TimeBloom(image);
+    std::cout << "Elapsed time (float):  " << elapsed_float << " seconds\n";
+    std::cout << "Speedup (float vs double): " << elapsed_double / elapsed_float << "x\n";
+    
+    // Largest deviation of the float result from the double reference
+    double max_error = 0.0;
+    const float* data = image.GetRawData();
+    const double* ref_data = reference.GetRawData();
+    size_t total_elements = image.GetSize();
+    for (size_t i = 0; i < total_elements; ++i) {
+        max_error = std::max(max_error, std::abs(data[i] - ref_data[i]));
+    }
+    std::cout << "Max abs error (float vs double): " << max_error << "\n";
+    
+    // Export path: last blend, bloom scale, clamp and 8-bit conversion in a single pass
+    std::vector<Color> colors((size_t)source.width * source.height);
     auto start = std::chrono::high_resolution_clock::now();
-    Bloom(image);
+    BloomToRGBA8(source, colors.data());
     auto end = std::chrono::high_resolution_clock::now();
+    std::chrono::duration<double> elapsed_export = end - start;
+    std::cout << "Elapsed time (float -> RGBA8): " << elapsed_export.count() << " seconds\n";
+    
+    // Streaming: one context reused for every frame, no allocations after construction
+    BloomContext<float> context(source.width, source.height, source.channels);
+    context.BloomToRGBA8(source, colors.data());
+    start = std::chrono::high_resolution_clock::now();
+    context.BloomToRGBA8(source, colors.data());
+    end = std::chrono::high_resolution_clock::now();
+    std::chrono::duration<double> elapsed_context = end - start;
+    std::cout << "Elapsed time (float -> RGBA8, reused context): " << elapsed_context.count() << " seconds\n";
+    
+    // Soft-knee bright-pass and Karis average fused into the first DownSample
+    BloomContext<float> prefiltered(source.width, source.height, source.channels, 8, {},
+                                    BloomPrefilter{.threshold = 0.8, .karis = true});
+    prefiltered.BloomToRGBA8(source, colors.data());
+    start = std::chrono::high_resolution_clock::now();
+    prefiltered.BloomToRGBA8(source, colors.data());
+    end = std::chrono::high_resolution_clock::now();
+    std::chrono::duration<double> elapsed_prefiltered = end - start;
+    std::cout << "Elapsed time (float -> RGBA8, bright-pass + Karis): " << elapsed_prefiltered.count() << " seconds\n";
+    
+    // 16-bit fixed point straight from the 8-bit samples, checked against the double reference
+    std::vector<unsigned char> bytes(source.GetSize());
+    MyImage<double> original(source.width, source.height, source.channels, ImageInit::Uninitialized);
+    for (size_t i = 0; i < bytes.size(); ++i) {
+        bytes[i] = (unsigned char)std::lround(source.GetRawData()[i] * 255.0f);
+        original.GetRawData()[i] = bytes[i] / 255.0;
+    }
+    std::vector<Color> reference_colors(colors.size());
+    BloomToRGBA8(original, reference_colors.data());
+    
+    FixedBloomContext fixed(source.width, source.height, source.channels);
+    fixed.BloomToRGBA8(bytes.data(), colors.data());
+    start = std::chrono::high_resolution_clock::now();
+    fixed.BloomToRGBA8(bytes.data(), colors.data());
+    end = std::chrono::high_resolution_clock::now();
+    std::chrono::duration<double> elapsed_fixed = end - start;
+    std::cout << "Elapsed time (fixed16 -> RGBA8, reused context): " << elapsed_fixed.count() << " seconds\n";
+    
+    int max_lsb = 0;
+    const unsigned char* fixed_bytes = reinterpret_cast<const unsigned char*>(colors.data());
+    const unsigned char* reference_bytes = reinterpret_cast<const unsigned char*>(reference_colors.data());
+    for (size_t i = 0; i < colors.size() * 4; ++i) {
+        max_lsb = std::max(max_lsb, std::abs(fixed_bytes[i] - reference_bytes[i]));
+    }
+    std::cout << "Max RGBA8 difference (fixed16 vs double): " << max_lsb << " LSB\n";
     
-    std::chrono::duration<double> elapsed = end - start;
-    std::cout << "Elapsed time: " << elapsed.count() << " seconds\n";
+    // Deadline mode: levels and precision picked from the measured frame times
+    BudgetBloomContext budget(source.width, source.height, source.channels, BloomBudget{.milliseconds = 8.0});
+    budget.BloomToRGBA8(bytes.data(), colors.data());
+    const BloomBudgetChoice& choice = budget.GetChoice();
+    std::cout << "Budget 8 ms: " << choice.levels << " levels (down to " << choice.coarsest_width << "x"
+              << choice.coarsest_height << "), " << GetPrecisionName(choice.precision) << ", "
+              << choice.expected_ms << " ms" << (choice.meets_budget ? "" : " (over budget)") << "\n";
     
     // image.Save("output.png");
+    // image.Save("output.pfm");   // Unclamped float samples
+    // SaveRGBA8(colors.data(), source.width, source.height, "output.png");
+    // SaveRGBA8(colors.data(), source.width, source.height, "output.qoi");
+    // SaveRGBA8(colors.data(), source.width, source.height, "output.png", SaveOptions{1});
     // DisplayImage("output.png");
     
     return 0;
-}
\ No newline at end of file
+}